@@ -0,0 +1,224 @@
+/* **************************************************************************
+ * Benchmark Harness
+ *
+ * Runs the runner over each workload listed in a manifest written by
+ * gen_bench, measuring the time to load the gamefile (with --load-only), the
+ * time to run it to completion, and the peak resident set size of each. The
+ * results are compared against a stored baseline, or recorded as the new
+ * baseline.
+ *
+ * Part of GTRPE by Gren Drake
+ * **************************************************************************/
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+    struct Measurement {
+        double seconds;
+        long peakKilobytes;
+    };
+
+    struct Result {
+        std::string name;
+        double loadMs, runMs, mopsPerSecond;
+        long peakKilobytes;
+    };
+
+    // run the runner once with its output discarded, returning false if it
+    // could not be run or did not exit successfully
+    bool measure(const std::string &runner, const std::vector<std::string> &args,
+                 Measurement &measurement) {
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>(runner.c_str()));
+        for (const std::string &arg : args) {
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+
+        auto start = std::chrono::steady_clock::now();
+        pid_t pid = fork();
+        if (pid < 0) return false;
+        if (pid == 0) {
+            int devNull = open("/dev/null", O_WRONLY);
+            if (devNull >= 0) dup2(devNull, STDOUT_FILENO);
+            execv(runner.c_str(), argv.data());
+            _exit(127);
+        }
+
+        int status = 0;
+        struct rusage usage;
+        if (wait4(pid, &status, 0, &usage) != pid) return false;
+        auto end = std::chrono::steady_clock::now();
+        measurement.seconds = std::chrono::duration<double>(end - start).count();
+        measurement.peakKilobytes = usage.ru_maxrss;
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    // the fastest of several runs, and the largest peak memory use
+    bool measureBest(const std::string &runner, const std::vector<std::string> &args,
+                     unsigned repeat, Measurement &best) {
+        best = Measurement{0, 0};
+        for (unsigned i = 0; i < repeat; ++i) {
+            Measurement m;
+            if (!measure(runner, args, m)) return false;
+            if (i == 0 || m.seconds < best.seconds) best.seconds = m.seconds;
+            best.peakKilobytes = std::max(best.peakKilobytes, m.peakKilobytes);
+        }
+        return true;
+    }
+
+    std::map<std::string, Result> readResults(const std::string &filename) {
+        std::map<std::string, Result> results;
+        std::ifstream in(filename);
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.empty() || line[0] == '#') continue;
+            std::istringstream fields(line);
+            Result result;
+            if (fields >> result.name >> result.loadMs >> result.runMs
+                       >> result.mopsPerSecond >> result.peakKilobytes) {
+                results[result.name] = result;
+            }
+        }
+        return results;
+    }
+
+    bool writeResults(const std::string &filename, const std::vector<Result> &results) {
+        std::ofstream out(filename);
+        out << "# workload\tload-ms\trun-ms\tmops-per-sec\tpeak-kb\n";
+        for (const Result &result : results) {
+            out << result.name << '\t' << result.loadMs << '\t' << result.runMs << '\t'
+                << result.mopsPerSecond << '\t' << result.peakKilobytes << '\n';
+        }
+        return static_cast<bool>(out);
+    }
+
+    // percentage change from the baseline, where positive is better
+    std::string change(double now, double before, bool higherIsBetter) {
+        if (before <= 0) return "";
+        double percent = (now - before) / before * 100;
+        if (!higherIsBetter) percent = -percent;
+        std::ostringstream ss;
+        ss << std::showpos << std::fixed << std::setprecision(1) << percent << '%';
+        return ss.str();
+    }
+
+    void usage(const char *name) {
+        std::cerr << "USAGE: " << name << " [options] workload-directory\n";
+        std::cerr << "  --runner=PATH       runner to measure (default ./runner)\n";
+        std::cerr << "  --runner-arg=ARG    pass ARG to the runner as well (repeatable)\n";
+        std::cerr << "  --baseline=FILE     results to compare against\n";
+        std::cerr << "  --record            store the results as the baseline\n";
+        std::cerr << "  --repeat=N          runs of each workload (default 3)\n";
+    }
+
+}
+
+int main(int argc, char *argv[]) {
+    std::string runner = "./runner", baselineFile, directory;
+    std::vector<std::string> runnerArgs;
+    bool record = false;
+    unsigned repeat = 3;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 9, "--runner=") == 0) {
+            runner = arg.substr(9);
+        } else if (arg.compare(0, 13, "--runner-arg=") == 0) {
+            runnerArgs.push_back(arg.substr(13));
+        } else if (arg.compare(0, 11, "--baseline=") == 0) {
+            baselineFile = arg.substr(11);
+        } else if (arg == "--record") {
+            record = true;
+        } else if (arg.compare(0, 9, "--repeat=") == 0) {
+            repeat = std::max(1, std::atoi(arg.c_str() + 9));
+        } else if (arg[0] != '-' && directory.empty()) {
+            directory = arg;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (directory.empty() || (record && baselineFile.empty())) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::ifstream manifest(directory + "/workloads.tsv");
+    if (!manifest) {
+        std::cerr << "Could not read ~" << directory << "/workloads.tsv~.\n";
+        return 1;
+    }
+    std::map<std::string, Result> baseline;
+    if (!record && !baselineFile.empty()) baseline = readResults(baselineFile);
+
+    std::cout << std::left << std::setw(16) << "workload" << std::right
+              << std::setw(10) << "load ms" << std::setw(10) << "run ms"
+              << std::setw(10) << "Mops/s" << std::setw(11) << "peak KB";
+    if (!baseline.empty()) {
+        std::cout << std::setw(10) << "load" << std::setw(10) << "speed" << std::setw(10) << "memory";
+    }
+    std::cout << '\n';
+
+    std::vector<Result> results;
+    std::string name, filename;
+    uint64_t ops;
+    while (manifest >> name >> filename >> ops) {
+        std::string gamefile = directory + '/' + filename;
+        std::vector<std::string> loadArgs = runnerArgs, runArgs = runnerArgs;
+        loadArgs.push_back("--load-only");
+        loadArgs.push_back(gamefile);
+        runArgs.push_back("--null-output");
+        runArgs.push_back(gamefile);
+        Measurement load, run;
+        if (!measureBest(runner, loadArgs, repeat, load)
+                || !measureBest(runner, runArgs, repeat, run)) {
+            std::cerr << "Running ~" << runner << "~ on ~" << gamefile << "~ failed.\n";
+            return 1;
+        }
+
+        // time spent executing is what remains after loading, and a workload
+        // that executes almost nothing has no meaningful speed
+        bool hasSpeed = ops >= 1000000;
+        double executing = std::max(run.seconds - load.seconds, 1e-6);
+        Result result{name, load.seconds * 1000, run.seconds * 1000,
+                      hasSpeed ? ops / executing / 1e6 : 0,
+                      std::max(load.peakKilobytes, run.peakKilobytes)};
+        results.push_back(result);
+
+        std::cout << std::left << std::setw(16) << name << std::right << std::fixed
+                  << std::setw(10) << std::setprecision(1) << result.loadMs
+                  << std::setw(10) << result.runMs
+                  << std::setw(10) << std::setprecision(2) << result.mopsPerSecond
+                  << std::setw(11) << result.peakKilobytes;
+        auto before = baseline.find(name);
+        if (before != baseline.end()) {
+            std::cout << std::setw(10) << change(result.loadMs, before->second.loadMs, false)
+                      << std::setw(10) << (hasSpeed ? change(result.mopsPerSecond, before->second.mopsPerSecond, true) : "")
+                      << std::setw(10) << change(result.peakKilobytes, before->second.peakKilobytes, false);
+        }
+        std::cout << '\n';
+    }
+
+    if (record) {
+        if (!writeResults(baselineFile, results)) {
+            std::cerr << "Could not write ~" << baselineFile << "~.\n";
+            return 1;
+        }
+        std::cout << "Recorded baseline in ~" << baselineFile << "~.\n";
+    }
+    return 0;
+}
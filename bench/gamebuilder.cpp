@@ -0,0 +1,176 @@
+#include <fstream>
+
+#include "gamebuilder.h"
+#include "gamedata.h"
+
+namespace {
+    void addValue(ByteStream &out, const Value &value) {
+        out.add_8(value.type);
+        out.add_32(value.value);
+    }
+}
+
+int GameBuilder::addString(const std::string &text) {
+    strings.push_back(text);
+    return strings.size() - 1;
+}
+
+void GameBuilder::addList(int ident, const std::vector<Value> &items) {
+    lists.add_32(ident);
+    lists.add_16(items.size());
+    for (const Value &item : items) {
+        addValue(lists, item);
+    }
+    ++listCount;
+}
+
+void GameBuilder::addObject(int ident, const std::vector<Property> &properties) {
+    objects.add_32(ident);
+    objects.add_16(properties.size());
+    for (const Property &property : properties) {
+        objects.add_16(property.first);
+        addValue(objects, property.second);
+    }
+    ++objectCount;
+}
+
+void GameBuilder::beginFunction(int ident, int argCount, int localCount) {
+    functionStart = code.size();
+    functions.push_back(FunctionHeader{ident, argCount, localCount, functionStart});
+    labels.clear();
+    labelUses.clear();
+}
+
+void GameBuilder::endFunction() {
+    if (!shortJumps) {
+        for (const auto &use : labelUses) {
+            code.overwrite_32(use.first + 2, labels[use.second]);
+        }
+        return;
+    }
+
+    // start every jump target push as a Push8 and widen those whose targets
+    // don't fit, which moves the labels after them, until all of them fit
+    std::vector<unsigned> widths(labelUses.size(), 1);
+    std::vector<int> placed(labels.size());
+    bool widened = true;
+    while (widened) {
+        for (unsigned label = 0; label < labels.size(); ++label) {
+            placed[label] = labels[label];
+            for (unsigned i = 0; i < labelUses.size(); ++i) {
+                if (static_cast<int>(labelUses[i].first - functionStart) < labels[label]) {
+                    placed[label] -= 4 - widths[i];
+                }
+            }
+        }
+        widened = false;
+        for (unsigned i = 0; i < labelUses.size(); ++i) {
+            int target = placed[labelUses[i].second];
+            unsigned width = target < 128 ? 1 : target < 32768 ? 2 : 4;
+            if (width > widths[i]) {
+                widths[i] = width;
+                widened = true;
+            }
+        }
+    }
+
+    ByteStream body;
+    body.append(code.bytes(), functionStart);
+    unsigned from = functionStart;
+    for (unsigned i = 0; i < labelUses.size(); ++i) {
+        unsigned at = labelUses[i].first;
+        int target = placed[labelUses[i].second];
+        body.append(code.bytes() + from, at - from);
+        if (widths[i] == 1) {
+            body.add_8(Opcode::Push8);
+            body.add_8(Value::JumpTarget);
+            body.add_8(target);
+        } else if (widths[i] == 2) {
+            body.add_8(Opcode::Push16);
+            body.add_8(Value::JumpTarget);
+            body.add_16(target);
+        } else {
+            body.add_8(Opcode::Push32);
+            body.add_8(Value::JumpTarget);
+            body.add_32(target);
+        }
+        from = at + 6;
+    }
+    body.append(code.bytes() + from, code.size() - from);
+    code = body;
+}
+
+void GameBuilder::push(Value::Type type, int value) {
+    ++instructionCount;
+    if (value == 0 || value == 1 || value == -1) {
+        code.add_8(value == 0 ? Opcode::Push0 : value == 1 ? Opcode::Push1 : Opcode::PushNeg1);
+        code.add_8(type);
+    } else if (value >= -128 && value < 128) {
+        code.add_8(Opcode::Push8);
+        code.add_8(type);
+        code.add_8(value);
+    } else if (value >= -32768 && value < 32768) {
+        code.add_8(Opcode::Push16);
+        code.add_8(type);
+        code.add_16(value);
+    } else {
+        code.add_8(Opcode::Push32);
+        code.add_8(type);
+        code.add_32(value);
+    }
+}
+
+void GameBuilder::op(Opcode::Opcode opcode) {
+    ++instructionCount;
+    code.add_8(opcode);
+}
+
+unsigned GameBuilder::newLabel() {
+    labels.push_back(-1);
+    return labels.size() - 1;
+}
+
+void GameBuilder::placeLabel(unsigned label) {
+    labels[label] = code.size() - functionStart;
+}
+
+void GameBuilder::pushLabel(unsigned label) {
+    ++instructionCount;
+    labelUses.push_back(std::make_pair(code.size(), label));
+    code.add_8(Opcode::Push32);
+    code.add_8(Value::JumpTarget);
+    code.add_32(0);
+}
+
+bool GameBuilder::write(const std::string &filename) const {
+    ByteStream out;
+    out.add_32(FILETYPE_ID);
+    out.add_32(0);
+    out.add_32(mainFunction);
+
+    out.add_32(strings.size());
+    for (const std::string &text : strings) {
+        out.add_16(text.size());
+        out.append(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+    }
+    out.add_32(listCount);
+    out.append(lists);
+    out.add_32(0);
+    out.add_32(objectCount);
+    out.append(objects);
+
+    out.add_32(functions.size());
+    for (const FunctionHeader &function : functions) {
+        out.add_32(function.ident);
+        out.add_16(function.argCount);
+        out.add_16(function.localCount);
+        out.add_32(function.position);
+    }
+    out.add_32(code.size());
+    out.append(code);
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) return false;
+    out.write(file);
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,70 @@
+#ifndef GAMEBUILDER_H
+#define GAMEBUILDER_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bytestream.h"
+#include "opcode.h"
+#include "value.h"
+
+// Assembles a version 0 gamefile in memory. Functions are written one at a
+// time between beginFunction and endFunction; jumps refer to labels, which
+// are resolved when the function ends. Jump targets are pushed with Push32,
+// or with the shortest push that holds them once setShortJumps is called, as
+// the compiler does.
+class GameBuilder {
+public:
+    typedef std::pair<unsigned, Value> Property;
+
+    GameBuilder() : mainFunction(0), instructionCount(0), functionStart(0), shortJumps(false) { }
+
+    void setMain(int ident) {
+        mainFunction = ident;
+    }
+    void setShortJumps(bool shortJumps) {
+        this->shortJumps = shortJumps;
+    }
+    int addString(const std::string &text);
+    void addList(int ident, const std::vector<Value> &items);
+    void addObject(int ident, const std::vector<Property> &properties);
+
+    void beginFunction(int ident, int argCount, int localCount);
+    void endFunction();
+
+    // push a value using the smallest push instruction that holds it
+    void push(Value::Type type, int value);
+    void op(Opcode::Opcode opcode);
+    unsigned newLabel();
+    void placeLabel(unsigned label);
+    void pushLabel(unsigned label);
+
+    // instructions written so far, for working out how many a workload runs
+    unsigned instructions() const {
+        return instructionCount;
+    }
+
+    bool write(const std::string &filename) const;
+private:
+    struct FunctionHeader {
+        int ident, argCount, localCount;
+        unsigned position;
+    };
+
+    int mainFunction;
+    std::vector<std::string> strings;
+    ByteStream lists, objects;
+    unsigned listCount = 0, objectCount = 0;
+    std::vector<FunctionHeader> functions;
+    ByteStream code;
+    unsigned instructionCount;
+
+    unsigned functionStart;
+    bool shortJumps;
+    std::vector<int> labels;
+    // where each push of a label starts, and the label
+    std::vector<std::pair<unsigned, unsigned>> labelUses;
+};
+
+#endif
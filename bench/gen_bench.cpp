@@ -0,0 +1,301 @@
+/* **************************************************************************
+ * Benchmark Workload Generator
+ *
+ * Writes a set of synthetic version 0 gamefiles, each stressing one part of
+ * the runner, along with a manifest (workloads.tsv) giving the number of
+ * instructions each one executes so the harness can report ops/sec.
+ *
+ * Part of GTRPE by Gren Drake
+ * **************************************************************************/
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "gamebuilder.h"
+
+namespace {
+
+    const int loopIterations = 1000000;
+    const int fibArgument = 25;
+    const int deepDepth = 100000;
+    const int deepRepeats = 20;
+    const int propertyObjects = 64;
+    const int sayIterations = 200000;
+    const int tableStrings = 200000;
+    const int tableObjects = 100000;
+    const int tableLists = 20000;
+
+    // local = value
+    void storeLocal(GameBuilder &b, int local) {
+        b.push(Value::LocalVar, local);
+        b.op(Opcode::Store);
+    }
+
+    // Emits "while (local < limit) { body; ++local; }" and returns the number
+    // of instructions it executes, given how many one pass of body runs.
+    template<class Body>
+    uint64_t countedLoop(GameBuilder &b, int local, int limit, Body body) {
+        unsigned top = b.newLabel(), done = b.newLabel();
+        unsigned start = b.instructions();
+        b.push(Value::Integer, 0);
+        storeLocal(b, local);
+        unsigned setup = b.instructions() - start;
+
+        start = b.instructions();
+        b.placeLabel(top);
+        b.push(Value::LocalVar, local);
+        b.push(Value::Integer, limit);
+        b.op(Opcode::Compare);
+        b.pushLabel(done);
+        b.op(Opcode::JumpGreaterThanEqual);
+        unsigned test = b.instructions() - start;
+
+        uint64_t bodyCount = body();
+
+        start = b.instructions();
+        b.push(Value::LocalVar, local);
+        b.push(Value::Integer, 1);
+        b.op(Opcode::Add);
+        storeLocal(b, local);
+        b.pushLabel(top);
+        b.op(Opcode::Jump);
+        unsigned step = b.instructions() - start;
+        b.placeLabel(done);
+
+        return setup + static_cast<uint64_t>(limit) * (test + bodyCount + step) + test;
+    }
+
+    // integer arithmetic in a tight loop
+    uint64_t arithmetic(GameBuilder &b) {
+        b.beginFunction(0, 0, 2);
+        b.push(Value::Integer, 0);
+        storeLocal(b, 1);
+        uint64_t ops = 3 + countedLoop(b, 0, loopIterations, [&b]() -> uint64_t {
+            // total = (total + i * 3) / 2
+            unsigned start = b.instructions();
+            b.push(Value::LocalVar, 1);
+            b.push(Value::LocalVar, 0);
+            b.push(Value::Integer, 3);
+            b.op(Opcode::Mult);
+            b.op(Opcode::Add);
+            b.push(Value::Integer, 2);
+            b.op(Opcode::Div);
+            storeLocal(b, 1);
+            return b.instructions() - start;
+        });
+        b.push(Value::LocalVar, 1);
+        b.op(Opcode::Return);
+        b.endFunction();
+        return ops + 2;
+    }
+
+    uint64_t fibOps(int n) {
+        // nine instructions reach the base case, nineteen recurse (each
+        // call counted in the callee, the return in the caller's add)
+        if (n < 2) return 9;
+        return 19 + fibOps(n - 1) + fibOps(n - 2);
+    }
+
+    // many shallow calls through a doubly recursive fibonacci
+    uint64_t fibonacci(GameBuilder &b) {
+        b.beginFunction(1, 1, 0);
+        unsigned small = b.newLabel();
+        b.push(Value::LocalVar, 0);
+        b.push(Value::Integer, 2);
+        b.op(Opcode::Compare);
+        b.pushLabel(small);
+        b.op(Opcode::JumpLessThan);
+        for (int offset = 1; offset <= 2; ++offset) {
+            b.push(Value::LocalVar, 0);
+            b.push(Value::Integer, offset);
+            b.op(Opcode::Sub);
+            b.push(Value::Integer, 1);
+            b.push(Value::Node, 1);
+            b.op(Opcode::Call);
+        }
+        b.op(Opcode::Add);
+        b.op(Opcode::Return);
+        b.placeLabel(small);
+        b.push(Value::LocalVar, 0);
+        b.push(Value::Integer, 0);
+        b.op(Opcode::Add);
+        b.op(Opcode::Return);
+        b.endFunction();
+
+        b.beginFunction(0, 0, 0);
+        b.push(Value::Integer, fibArgument);
+        b.push(Value::Integer, 1);
+        b.push(Value::Node, 1);
+        b.op(Opcode::Call);
+        b.op(Opcode::Return);
+        b.endFunction();
+        return 5 + fibOps(fibArgument);
+    }
+
+    // a chain of calls deep enough to make the runner grow its stacks
+    uint64_t deepRecursion(GameBuilder &b) {
+        b.beginFunction(1, 1, 0);
+        unsigned bottom = b.newLabel();
+        b.push(Value::LocalVar, 0);
+        b.pushLabel(bottom);
+        b.op(Opcode::JumpZero);
+        b.push(Value::LocalVar, 0);
+        b.push(Value::Integer, 1);
+        b.op(Opcode::Sub);
+        b.push(Value::Integer, 1);
+        b.push(Value::Node, 1);
+        b.op(Opcode::Call);
+        b.push(Value::Integer, 1);
+        b.op(Opcode::Add);
+        b.op(Opcode::Return);
+        b.placeLabel(bottom);
+        b.push(Value::Integer, 0);
+        b.op(Opcode::Return);
+        b.endFunction();
+
+        b.beginFunction(0, 0, 1);
+        uint64_t ops = countedLoop(b, 0, deepRepeats, [&b]() -> uint64_t {
+            b.push(Value::Integer, deepDepth);
+            b.push(Value::Integer, 1);
+            b.push(Value::Node, 1);
+            b.op(Opcode::Call);
+            b.op(Opcode::StackPop);
+            // each level runs 12 instructions and the bottom 5
+            return 5 + static_cast<uint64_t>(deepDepth) * 12 + 5;
+        });
+        b.push(Value::Integer, 0);
+        b.op(Opcode::Return);
+        b.endFunction();
+        return ops + 2;
+    }
+
+    // property reads from objects of several different shapes
+    uint64_t properties(GameBuilder &b) {
+        for (int i = 1; i <= propertyObjects; ++i) {
+            std::vector<GameBuilder::Property> props;
+            for (int propId = 1; propId <= 16; ++propId) {
+                if ((i + propId) % (i % 4 + 2) != 0) {
+                    props.push_back(std::make_pair(propId, Value{Value::Integer, propId * i}));
+                }
+            }
+            b.addObject(i, props);
+        }
+
+        b.beginFunction(0, 0, 2);
+        b.push(Value::Integer, 0);
+        storeLocal(b, 1);
+        uint64_t ops = 3 + countedLoop(b, 0, loopIterations / 16, [&b]() -> uint64_t {
+            unsigned start = b.instructions();
+            for (int k = 0; k < 16; ++k) {
+                b.push(Value::LocalVar, 1);
+                b.push(Value::Property, k % 16 + 1);
+                b.push(Value::Object, (k * 7) % propertyObjects + 1);
+                b.op(Opcode::GetProp);
+                b.op(Opcode::Add);
+                b.push(Value::Integer, 2);
+                b.op(Opcode::Div);
+                storeLocal(b, 1);
+            }
+            return b.instructions() - start;
+        });
+        b.push(Value::LocalVar, 1);
+        b.op(Opcode::Return);
+        b.endFunction();
+        return ops + 2;
+    }
+
+    // text and number output
+    uint64_t textOutput(GameBuilder &b) {
+        int words[] = {
+            b.addString("You are standing in an open field west of a white house. "),
+            b.addString("There is a small mailbox here. "),
+            b.addString("Score: "),
+            b.addString("\n"),
+        };
+
+        b.beginFunction(0, 0, 1);
+        uint64_t ops = countedLoop(b, 0, sayIterations, [&b, &words]() -> uint64_t {
+            unsigned start = b.instructions();
+            for (int word : words) {
+                b.push(Value::String, word);
+                b.op(Opcode::Say);
+                if (word == words[2]) {
+                    b.push(Value::LocalVar, 0);
+                    b.op(Opcode::Say);
+                }
+            }
+            return b.instructions() - start;
+        });
+        b.push(Value::Integer, 0);
+        b.op(Opcode::Return);
+        b.endFunction();
+        return ops + 2;
+    }
+
+    // very large tables that take most of the time to load
+    uint64_t largeTables(GameBuilder &b) {
+        for (int i = 0; i < tableStrings; ++i) {
+            b.addString("Description of thing number " + std::to_string(i) + '.');
+        }
+        for (int i = 0; i < tableObjects; ++i) {
+            std::vector<GameBuilder::Property> props;
+            for (int propId = 1; propId <= 8; ++propId) {
+                if ((i >> propId) & 1) {
+                    props.push_back(std::make_pair(propId, Value{Value::String, i % tableStrings}));
+                }
+            }
+            b.addObject(i + 1, props);
+        }
+        for (int i = 0; i < tableLists; ++i) {
+            std::vector<Value> items(i % 16, Value{Value::Object, i + 1});
+            b.addList(i + 1, items);
+        }
+
+        b.beginFunction(0, 0, 0);
+        b.push(Value::Integer, 0);
+        b.op(Opcode::Return);
+        b.endFunction();
+        return 2;
+    }
+
+    struct Workload {
+        const char *name;
+        uint64_t (*build)(GameBuilder &b);
+    };
+
+    const Workload workloads[] = {
+        { "arithmetic",     arithmetic },
+        { "fibonacci",      fibonacci },
+        { "deep-recursion", deepRecursion },
+        { "properties",     properties },
+        { "text-output",    textOutput },
+        { "large-tables",   largeTables },
+    };
+
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        std::cerr << "USAGE: " << argv[0] << " output-directory\n";
+        return 1;
+    }
+    std::string directory = argv[1];
+
+    std::ofstream manifest(directory + "/workloads.tsv");
+    if (!manifest) {
+        std::cerr << "Could not write to ~" << directory << "~.\n";
+        return 1;
+    }
+    for (const Workload &workload : workloads) {
+        GameBuilder builder;
+        uint64_t ops = workload.build(builder);
+        std::string filename = std::string(workload.name) + ".bin";
+        if (!builder.write(directory + '/' + filename)) {
+            std::cerr << "Could not write ~" << filename << "~.\n";
+            return 1;
+        }
+        manifest << workload.name << '\t' << filename << '\t' << ops << '\n';
+    }
+    return 0;
+}
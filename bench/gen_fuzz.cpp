@@ -0,0 +1,570 @@
+/* **************************************************************************
+ * Random Gamefile Generator
+ *
+ * Writes a random version 0 gamefile for fuzzing the runner with --diff,
+ * which runs it on the reference interpreter and the faster engines and
+ * checks that they agree. The same seed always gives the same gamefile.
+ *
+ * Programs are built from random expressions and statements that keep the
+ * stack balanced and always end: loops are counted, and functions only call
+ * those generated before them or the two recursive helpers, which are given
+ * bounded arguments. Locals hold integers, apart from main's lists, map and
+ * object made at run time, so most programs run to the end; a few are given
+ * a deliberate runtime error, and some functions are made to fail the
+ * verifier so that they run checked. Jump targets are pushed in whichever of
+ * Push8, Push16 and Push32 the compiler would use, so that each form of the
+ * jump superinstructions is fused, apart from some seeds that use Push32
+ * throughout.
+ *
+ * Part of GTRPE by Gren Drake
+ * **************************************************************************/
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gamebuilder.h"
+
+namespace {
+
+    const int objectCount = 3;
+    const int listCount = 2;
+    // string 0 is a newline and string 1 is empty, which packed strings
+    // have to keep apart from the string after it
+    const int stringCount = 5;
+    // properties 1 to propertyCount hold integers; containerProperty is given
+    // the lists main makes, so that they stay reachable from an object
+    const int propertyCount = 4;
+    const int containerProperty = 9;
+    // the recursive helpers: sum(n) adds up to n by recursion, and
+    // tailSum(n, total) does the same by tail calls
+    const int sumFunction = 100;
+    const int tailSumFunction = 101;
+    const int maxRecursion = 300;
+    // rough limit on the instructions one call of a function may run
+    const int64_t maxCost = 200000;
+    const int maxDepth = 3;
+
+    class Fuzzer {
+    public:
+        explicit Fuzzer(unsigned seed)
+        : random(seed), b(nullptr), errors(false), valueLocals(0), loopLocal(0),
+          containerLocal(-1), loopDepth(0), weight(1), cost(0)
+        { }
+
+        void build(GameBuilder &builder);
+    private:
+        struct Callee {
+            int ident, args;
+            int64_t cost;
+        };
+
+        int pick(int low, int high) {
+            return std::uniform_int_distribution<int>(low, high)(random);
+        }
+        bool chance(int percent) {
+            return pick(0, 99) < percent;
+        }
+
+        void recursiveHelpers();
+        void function(int ident, int args, bool isMain, bool verifiable);
+        void literal();
+        void operand(int depth);
+        void expression(int depth);
+        bool call(int depth);
+        void object();
+        void statement(int depth);
+        void block(int depth, int count);
+        void loop(int depth);
+        void branch(int depth);
+        void runtimeError();
+
+        std::mt19937 random;
+        GameBuilder *b;
+        bool errors;
+        std::vector<Callee> callees;
+
+        // the function being generated: its locals are the integer ones
+        // (arguments first), then a counter for each level of loop, then in
+        // main a list, a map and an object
+        int valueLocals;
+        int loopLocal;
+        int containerLocal;
+        int loopDepth;
+        int64_t weight;
+        int64_t cost;
+    };
+
+    void Fuzzer::build(GameBuilder &builder) {
+        b = &builder;
+        errors = chance(25);
+        // mostly the shortest pushes of jump targets, as the compiler writes
+        // them, but sometimes all Push32, as optimize leaves them
+        b->setShortJumps(chance(80));
+        for (int i = 0; i < stringCount; ++i) {
+            if (i == 0) {
+                b->addString("\n");
+            } else if (i == 1) {
+                b->addString("");
+            } else {
+                b->addString("word" + std::to_string(i) + ' ');
+            }
+        }
+        for (int ident = 1; ident <= objectCount; ++ident) {
+            std::vector<GameBuilder::Property> props;
+            for (int propId = 1; propId <= propertyCount; ++propId) {
+                if (chance(70)) props.push_back(std::make_pair(propId, Value{Value::Integer, pick(-50, 50)}));
+            }
+            b->addObject(ident, props);
+        }
+        for (int ident = 1; ident <= listCount; ++ident) {
+            std::vector<Value> items;
+            for (int i = pick(1, 4); i > 0; --i) {
+                items.push_back(Value{Value::Integer, pick(-100, 100)});
+            }
+            b->addList(ident, items);
+        }
+
+        recursiveHelpers();
+        // each function may call those made before it, so nothing recurses
+        // but the helpers
+        for (int ident = pick(1, 5); ident > 0; --ident) {
+            function(ident, pick(0, 2), false, !chance(30));
+        }
+        function(0, 0, true, !chance(10));
+        b->setMain(0);
+    }
+
+    void Fuzzer::recursiveHelpers() {
+        b->beginFunction(sumFunction, 1, 0);
+        unsigned base = b->newLabel();
+        b->push(Value::LocalVar, 0);
+        b->pushLabel(base);
+        b->op(Opcode::JumpLessThanEqual);
+        b->push(Value::LocalVar, 0);
+        b->push(Value::Integer, 1);
+        b->op(Opcode::Sub);
+        b->push(Value::Integer, 1);
+        b->push(Value::Node, sumFunction);
+        b->op(Opcode::Call);
+        b->push(Value::LocalVar, 0);
+        b->op(Opcode::Add);
+        b->op(Opcode::Return);
+        b->placeLabel(base);
+        b->push(Value::Integer, 0);
+        b->op(Opcode::Return);
+        b->endFunction();
+        callees.push_back(Callee{sumFunction, 1, maxRecursion * 12});
+
+        b->beginFunction(tailSumFunction, 2, 0);
+        base = b->newLabel();
+        b->push(Value::LocalVar, 0);
+        b->pushLabel(base);
+        b->op(Opcode::JumpLessThanEqual);
+        b->push(Value::LocalVar, 0);
+        b->push(Value::Integer, 1);
+        b->op(Opcode::Sub);
+        b->push(Value::LocalVar, 1);
+        b->push(Value::LocalVar, 0);
+        b->op(Opcode::Add);
+        b->push(Value::Integer, 2);
+        b->push(Value::Node, tailSumFunction);
+        b->op(Opcode::Call);
+        b->op(Opcode::Return);
+        b->placeLabel(base);
+        b->push(Value::LocalVar, 1);
+        b->push(Value::Integer, 0);
+        b->op(Opcode::Add);
+        b->op(Opcode::Return);
+        b->endFunction();
+        callees.push_back(Callee{tailSumFunction, 2, maxRecursion * 14});
+    }
+
+    void Fuzzer::function(int ident, int args, bool isMain, bool verifiable) {
+        valueLocals = args + pick(1, 3);
+        loopLocal = valueLocals;
+        containerLocal = isMain ? loopLocal + 2 : -1;
+        loopDepth = 0;
+        weight = 1;
+        cost = 0;
+        b->beginFunction(ident, args, valueLocals - args + 2 + (isMain ? 3 : 0));
+
+        if (!verifiable) {
+            // a jump that is always taken, past a push that leaves the stack
+            // deeper on the path the verifier also has to allow for
+            unsigned skip = b->newLabel();
+            b->push(Value::Integer, 1);
+            b->pushLabel(skip);
+            b->op(Opcode::JumpNotZero);
+            b->push(Value::Integer, 0);
+            b->placeLabel(skip);
+        }
+        for (int local = args; local < valueLocals; ++local) {
+            literal();
+            b->push(Value::LocalVar, local);
+            b->op(Opcode::Store);
+        }
+        if (isMain) {
+            const Opcode::Opcode makers[] = { Opcode::NewList, Opcode::NewMap, Opcode::NewObject };
+            for (int i = 0; i < 3; ++i) {
+                b->op(makers[i]);
+                b->push(Value::LocalVar, containerLocal + i);
+                b->op(Opcode::Store);
+            }
+        }
+
+        block(0, pick(3, isMain ? 12 : 6));
+        expression(0);
+        b->op(Opcode::Return);
+        b->endFunction();
+        callees.push_back(Callee{ident, args, cost + 1});
+    }
+
+    void Fuzzer::literal() {
+        static const int interesting[] = {
+            0, 1, -1, 2, 127, 128, -128, -129, 255, 32767, 32768, -32768, -32769, 65536,
+            1000000, -1000000
+        };
+        if (chance(60)) {
+            b->push(Value::Integer, pick(-10, 10));
+        } else {
+            b->push(Value::Integer, interesting[pick(0, sizeof interesting / sizeof *interesting - 1)]);
+        }
+    }
+
+    // something for an instruction to read straight away: an integer, or a
+    // local holding one
+    void Fuzzer::operand(int depth) {
+        if (chance(35)) {
+            b->push(Value::LocalVar, pick(0, valueLocals - 1));
+        } else {
+            expression(depth);
+        }
+    }
+
+    // push an integer
+    void Fuzzer::expression(int depth) {
+        cost += weight;
+        int kind = depth >= maxDepth ? pick(0, 1) : pick(0, 15);
+        switch (kind) {
+            case 0:
+                literal();
+                break;
+            case 1:
+                // the sequences fused into AddImmediate, AddLocal and so on
+                b->push(Value::LocalVar, pick(0, valueLocals - 1));
+                b->push(Value::Integer, pick(-1, 1));
+                b->op(chance(50) ? Opcode::Add : Opcode::Sub);
+                break;
+            case 2:
+            case 3:
+                operand(depth + 1);
+                operand(depth + 1);
+                b->op(chance(50) ? Opcode::Add : Opcode::Sub);
+                break;
+            case 4:
+                operand(depth + 1);
+                b->push(Value::Integer, pick(-3, 3));
+                b->op(Opcode::Mult);
+                break;
+            case 5: {
+                static const int divisors[] = { 2, 3, 7, -2, 1000 };
+                operand(depth + 1);
+                b->push(Value::Integer, divisors[pick(0, 4)]);
+                b->op(Opcode::Div);
+                break;
+            }
+            case 6:
+                operand(depth + 1);
+                operand(depth + 1);
+                b->op(chance(80) ? Opcode::Compare : Opcode::CompareTypes);
+                break;
+            case 7:
+                b->push(Value::Property, pick(1, propertyCount + 1));
+                object();
+                b->op(chance(75) ? Opcode::GetProp : Opcode::HasProp);
+                break;
+            case 8:
+                b->push(Value::Integer, pick(-1, 5));
+                b->push(Value::List, pick(1, listCount));
+                b->op(chance(75) ? Opcode::GetItem : Opcode::HasItem);
+                break;
+            case 9:
+                if (containerLocal >= 0 && chance(50)) {
+                    operand(depth + 1);
+                    b->push(Value::LocalVar, containerLocal + pick(0, 1));
+                    b->op(chance(60) ? Opcode::GetItem : Opcode::HasItem);
+                } else if (containerLocal >= 0) {
+                    b->push(Value::LocalVar, containerLocal + pick(0, 1));
+                    b->op(Opcode::GetSize);
+                } else {
+                    b->push(Value::List, pick(1, listCount));
+                    b->op(Opcode::GetSize);
+                }
+                break;
+            case 10:
+            case 11:
+                if (!call(depth)) literal();
+                break;
+            case 12:
+                b->op(Opcode::StackSize);
+                break;
+            case 13:
+                expression(depth + 1);
+                b->op(Opcode::StackDup);
+                b->op(Opcode::Add);
+                break;
+            default:
+                b->push(Value::LocalVar, pick(0, valueLocals - 1));
+                b->push(Value::Integer, 0);
+                b->op(Opcode::Add);
+                break;
+        }
+    }
+
+    // call a function that won't take too long, if there is one
+    bool Fuzzer::call(int depth) {
+        if (callees.empty()) return false;
+        const Callee &callee = callees[pick(0, callees.size() - 1)];
+        if (weight * callee.cost > maxCost) return false;
+        cost += weight * callee.cost;
+        for (int i = 0; i < callee.args; ++i) {
+            if (callee.ident == sumFunction || callee.ident == tailSumFunction) {
+                b->push(Value::Integer, pick(-2, maxRecursion));
+            } else {
+                expression(depth + 1);
+            }
+        }
+        b->push(Value::Integer, callee.args);
+        b->push(Value::Node, callee.ident);
+        b->op(Opcode::Call);
+        return true;
+    }
+
+    void Fuzzer::object() {
+        if (containerLocal >= 0 && chance(30)) {
+            b->push(Value::LocalVar, containerLocal + 2);
+        } else {
+            b->push(Value::Object, pick(1, objectCount));
+        }
+    }
+
+    void Fuzzer::statement(int depth) {
+        cost += weight;
+        if (errors && chance(2)) {
+            runtimeError();
+            return;
+        }
+        int kind = pick(0, containerLocal >= 0 ? 15 : 11);
+        switch (kind) {
+            case 0:
+            case 1:
+                expression(0);
+                b->push(Value::LocalVar, pick(0, valueLocals - 1));
+                b->op(Opcode::Store);
+                break;
+            case 2:
+                if (chance(50)) {
+                    b->push(Value::String, pick(0, stringCount - 1));
+                } else {
+                    operand(0);
+                }
+                b->op(chance(80) ? Opcode::Say : Opcode::SayUnsigned);
+                break;
+            case 3:
+            case 4:
+                if (depth < maxDepth) {
+                    branch(depth);
+                } else {
+                    expression(0);
+                    b->op(Opcode::StackPop);
+                }
+                break;
+            case 5:
+                if (depth < maxDepth && loopDepth < 2) {
+                    loop(depth);
+                } else {
+                    expression(0);
+                    b->op(Opcode::Say);
+                }
+                break;
+            case 6:
+                expression(0);
+                b->op(Opcode::StackPop);
+                break;
+            case 7:
+                expression(0);
+                b->push(Value::Property, pick(1, propertyCount));
+                object();
+                b->op(Opcode::SetProp);
+                break;
+            case 8:
+                // replace the first item, or add one to the end
+                expression(0);
+                if (chance(50)) {
+                    b->push(Value::Integer, 0);
+                } else {
+                    b->push(Value::List, 1);
+                    b->op(Opcode::GetSize);
+                }
+                b->push(Value::List, 1);
+                b->op(Opcode::SetItem);
+                break;
+            case 9:
+                if (!call(0)) literal();
+                b->op(Opcode::StackPop);
+                break;
+            case 10:
+                b->op(Opcode::WaitKey);
+                b->op(Opcode::Say);
+                break;
+            case 11:
+                b->push(Value::String, 0);
+                b->op(Opcode::Say);
+                break;
+            case 12:
+                // make a new list, leaving the old one for the collector
+                // unless an object or the map still holds it
+                b->op(Opcode::NewList);
+                b->push(Value::LocalVar, containerLocal);
+                b->op(Opcode::Store);
+                break;
+            case 13:
+                expression(0);
+                b->push(Value::LocalVar, containerLocal);
+                b->op(Opcode::GetSize);
+                b->push(Value::LocalVar, containerLocal);
+                b->op(Opcode::SetItem);
+                break;
+            case 14:
+                expression(0);
+                operand(0);
+                b->push(Value::LocalVar, containerLocal + 1);
+                b->op(Opcode::SetItem);
+                break;
+            default:
+                // keep the list reachable, under a key or property that is
+                // never read as an integer
+                b->push(Value::LocalVar, containerLocal);
+                if (chance(50)) {
+                    b->push(Value::String, pick(0, stringCount - 1));
+                    b->push(Value::LocalVar, containerLocal + 1);
+                    b->op(Opcode::SetItem);
+                } else {
+                    b->push(Value::Property, containerProperty);
+                    object();
+                    b->op(Opcode::SetProp);
+                }
+                break;
+        }
+    }
+
+    void Fuzzer::block(int depth, int count) {
+        for (int i = 0; i < count; ++i) {
+            statement(depth);
+        }
+    }
+
+    // for (counter = 0; counter < iterations; ++counter) { ... }
+    void Fuzzer::loop(int depth) {
+        int counter = loopLocal + loopDepth;
+        int iterations = pick(0, containerLocal >= 0 && loopDepth == 0 ? 300 : 12);
+        if (weight * (iterations + 1) > maxCost) iterations = 1;
+        unsigned top = b->newLabel(), done = b->newLabel();
+        b->push(Value::Integer, 0);
+        b->push(Value::LocalVar, counter);
+        b->op(Opcode::Store);
+        b->placeLabel(top);
+        b->push(Value::LocalVar, counter);
+        b->push(Value::Integer, iterations);
+        b->op(Opcode::Compare);
+        b->pushLabel(done);
+        b->op(Opcode::JumpGreaterThanEqual);
+
+        int64_t outerWeight = weight;
+        weight *= iterations + 1;
+        ++loopDepth;
+        block(depth + 1, pick(1, 4));
+        --loopDepth;
+        weight = outerWeight;
+
+        b->push(Value::LocalVar, counter);
+        b->push(Value::Integer, 1);
+        b->op(Opcode::Add);
+        b->push(Value::LocalVar, counter);
+        b->op(Opcode::Store);
+        b->pushLabel(top);
+        b->op(Opcode::Jump);
+        b->placeLabel(done);
+    }
+
+    void Fuzzer::branch(int depth) {
+        static const Opcode::Opcode jumps[] = {
+            Opcode::JumpZero, Opcode::JumpNotZero, Opcode::JumpLessThan,
+            Opcode::JumpLessThanEqual, Opcode::JumpGreaterThan, Opcode::JumpGreaterThanEqual
+        };
+        unsigned otherwise = b->newLabel(), done = b->newLabel();
+        operand(1);
+        if (chance(60)) {
+            operand(1);
+            b->op(Opcode::Compare);
+        }
+        b->pushLabel(otherwise);
+        b->op(jumps[pick(0, 5)]);
+        block(depth + 1, pick(1, 3));
+        if (chance(50)) {
+            b->pushLabel(done);
+            b->op(Opcode::Jump);
+            b->placeLabel(otherwise);
+            block(depth + 1, pick(1, 3));
+        } else {
+            b->placeLabel(otherwise);
+        }
+        b->placeLabel(done);
+    }
+
+    // something both engines must stop at with the same message
+    void Fuzzer::runtimeError() {
+        switch (pick(0, 3)) {
+            case 0:
+                b->push(Value::String, 1);
+                b->push(Value::Integer, 1);
+                b->op(Opcode::Add);
+                break;
+            case 1:
+                b->push(Value::String, 1);
+                b->push(Value::Integer, 1);
+                b->op(Opcode::Compare);
+                break;
+            case 2:
+                b->push(Value::Integer, 1);
+                b->push(Value::Integer, 100);
+                b->push(Value::List, 1);
+                b->op(Opcode::SetItem);
+                break;
+            default:
+                b->push(Value::Property, 1);
+                b->push(Value::Integer, 1);
+                b->op(Opcode::GetProp);
+                break;
+        }
+        b->op(Opcode::StackPop);
+    }
+
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        std::cerr << "USAGE: " << argv[0] << " seed output-file\n";
+        return 1;
+    }
+    GameBuilder builder;
+    Fuzzer(std::strtoul(argv[1], nullptr, 10)).build(builder);
+    if (!builder.write(argv[2])) {
+        std::cerr << "Could not write to ~" << argv[2] << "~.\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,177 @@
+/* **************************************************************************
+ * Headless Batch Runner
+ *
+ * Plays a game through many recorded transcripts at once, for regression
+ * runs. Each playthrough gets its own Runner over the shared GameData, runs
+ * a turn at a time with start and resume, and sends its output to a hash
+ * (and a file, if wanted) rather than the screen, so that runs can be
+ * compared by a single line each.
+ *
+ * Part of GTRPE by Gren Drake
+ * **************************************************************************/
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#include "batch.h"
+#include "runner.h"
+#include "runtime_error.h"
+
+namespace {
+
+    // size of each playthrough's output buffer
+    const size_t batchBufferSize = 16384;
+
+    class FileSink : public OutputSink {
+    public:
+        explicit FileSink(const std::string &filename)
+        : file(filename, std::ios::binary)
+        { }
+        bool good() const {
+            return static_cast<bool>(file);
+        }
+        void write(const char *text, size_t length) override {
+            file.write(text, length);
+        }
+        void flush() override {
+            file.flush();
+        }
+    private:
+        std::ofstream file;
+    };
+
+    // an input source for a runner that is only ever resumed, so WaitKey
+    // always suspends rather than reading
+    class NoInput : public InputSource {
+    public:
+        void read(std::string &word) override {
+            word.clear();
+        }
+    };
+
+    std::string baseName(const std::string &path) {
+        size_t slash = path.find_last_of('/');
+        return slash == std::string::npos ? path : path.substr(slash + 1);
+    }
+
+}
+
+Batch::Batch(std::shared_ptr<const GameData> data, const BatchOptions &options,
+             std::ostream &out)
+: data(data), options(options), out(out), transcripts(nullptr), nextToPlay(0),
+  nextToReport(0), succeeded(true)
+{ }
+
+bool Batch::run(const std::vector<std::string> &transcripts) {
+    this->transcripts = &transcripts;
+    results.assign(transcripts.size(), Result());
+    nextToPlay = nextToReport = 0;
+    succeeded = true;
+
+    unsigned threads = options.threads;
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    if (threads > transcripts.size()) threads = transcripts.size();
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < threads; ++i) {
+        workers.push_back(std::thread(&Batch::worker, this));
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+    return succeeded;
+}
+
+void Batch::worker() {
+    while (1) {
+        unsigned index;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (nextToPlay == transcripts->size()) return;
+            index = nextToPlay++;
+        }
+        Result result;
+        play((*transcripts)[index], result);
+        report(index, result);
+    }
+}
+
+void Batch::play(const std::string &transcript, Result &result) {
+    std::ifstream file(transcript);
+    std::vector<std::string> words;
+    std::string word;
+    while (file >> word) {
+        words.push_back(word);
+    }
+    if (!file.eof()) {
+        result.status = "unreadable";
+        return;
+    }
+
+    Runner runner;
+    runner.attach(data);
+    runner.setInput(std::unique_ptr<InputSource>(new NoInput));
+    std::unique_ptr<OutputSink> copy;
+    if (!options.outputDirectory.empty()) {
+        std::string filename = options.outputDirectory + '/' + baseName(transcript) + ".out";
+        FileSink *sink = new FileSink(filename);
+        copy.reset(sink);
+        if (!sink->good()) {
+            result.status = "error";
+            result.message = "could not write to " + filename;
+            return;
+        }
+    }
+    HashSink *hash = new HashSink(std::move(copy));
+    runner.getOutput().setBufferSize(batchBufferSize);
+    runner.getOutput().setSink(std::unique_ptr<OutputSink>(hash));
+    if (!options.fusion) runner.disableFusion();
+    if (options.useJit) runner.enableJit(options.jitThreshold);
+
+    int64_t budget = Runner::unlimited;
+    if (options.turnLimit > 0) budget = options.turnLimit;
+    try {
+        runner.startMain();
+        while (1) {
+            RunStatus status = runner.resume(budget);
+            if (status == RunStatus::Finished) {
+                result.status = "end";
+                break;
+            } else if (status == RunStatus::OutOfBudget) {
+                result.status = "limit";
+                break;
+            } else if (result.words == words.size()) {
+                result.status = "wait";
+                break;
+            }
+            runner.giveKey(words[result.words++]);
+        }
+    } catch (RuntimeError &e) {
+        result.status = "error";
+        result.message = e.what();
+    }
+    runner.getOutput().flush();
+    result.hash = hash->hash();
+    result.size = hash->size();
+}
+
+// record a result, and write out every one that is now next in order
+void Batch::report(unsigned index, Result &result) {
+    std::lock_guard<std::mutex> lock(mutex);
+    results[index] = std::move(result);
+    results[index].done = true;
+    while (nextToReport < results.size() && results[nextToReport].done) {
+        Result &next = results[nextToReport];
+        if (next.status == "error" || next.status == "unreadable") succeeded = false;
+        out << (*transcripts)[nextToReport] << '\t' << next.status << '\t'
+            << std::hex << std::setw(16) << std::setfill('0') << next.hash
+            << std::dec << std::setfill(' ') << '\t' << next.size << '\t' << next.words;
+        if (!next.message.empty()) out << '\t' << next.message;
+        out << '\n';
+        next = Result();
+        next.done = true;
+        ++nextToReport;
+    }
+    out.flush();
+}
@@ -0,0 +1,74 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "gamedata.h"
+
+struct BatchOptions {
+    unsigned threads = 0;           // 0 to use one per core
+    bool useJit = false;
+    unsigned jitThreshold = 0;
+    bool fusion = true;
+    // calls and backward jumps one turn may make before the playthrough is
+    // stopped, or 0 for no limit
+    int64_t turnLimit = 0;
+    // directory to write what each playthrough printed to, or empty to keep
+    // only its hash
+    std::string outputDirectory;
+};
+
+// Plays a game through once for each of a list of transcripts, without
+// anyone at the keyboard, on a pool of worker threads sharing one GameData.
+// A transcript is a text file of what the player typed, and each WaitKey is
+// given its next word. A playthrough ends when main returns, when the game
+// waits for a key after the transcript has run out, when a turn goes past
+// the limit, or at a runtime error. For each, in the order given, one line
+// of tab-separated fields is written:
+//
+//   TRANSCRIPT STATUS HASH BYTES WORDS [MESSAGE]
+//
+// where STATUS is end, wait, limit, error or unreadable (the transcript
+// could not be read), HASH is the 64-bit FNV-1a hash in hex of the BYTES
+// bytes printed, WORDS is how many words of the transcript were used, and
+// MESSAGE is the runtime error, if any.
+class Batch {
+public:
+    Batch(std::shared_ptr<const GameData> data, const BatchOptions &options, std::ostream &out);
+    Batch(const Batch&) = delete;
+    Batch& operator=(const Batch&) = delete;
+
+    // returns false if any transcript could not be read or stopped with an
+    // error
+    bool run(const std::vector<std::string> &transcripts);
+private:
+    struct Result {
+        bool done = false;
+        std::string status;
+        uint64_t hash = 0, size = 0;
+        unsigned words = 0;
+        std::string message;
+    };
+
+    void worker();
+    void play(const std::string &transcript, Result &result);
+    void report(unsigned index, Result &result);
+
+    std::shared_ptr<const GameData> data;
+    BatchOptions options;
+    std::ostream &out;
+
+    std::mutex mutex;
+    const std::vector<std::string> *transcripts;
+    std::vector<Result> results;
+    unsigned nextToPlay, nextToReport;
+    bool succeeded;
+};
+
+#endif
@@ -4,73 +4,90 @@
 
 #include "bytestream.h"
 
+void ByteStream::view(const uint8_t *bytes, unsigned size) {
+    data.clear();
+    external = bytes;
+    externalSize = size;
+}
+
+void ByteStream::makeOwned() {
+    if (external) {
+        data.assign(external, external + externalSize);
+        external = nullptr;
+        externalSize = 0;
+    }
+}
+
 void ByteStream::add_8(uint8_t value) {
+    makeOwned();
     data.push_back(value);
 }
 
 void ByteStream::add_16(uint16_t value) {
+    makeOwned();
     data.push_back(value & 0xFF);
     data.push_back((value >> 8) & 0xFF);
 }
 
 void ByteStream::add_32(uint32_t value) {
+    makeOwned();
     data.push_back(value & 0xFF);
     data.push_back((value >> 8) & 0xFF);
     data.push_back((value >> 16) & 0xFF);
     data.push_back((value >> 24) & 0xFF);
 }
 
+void ByteStream::append(const uint8_t *bytes, size_t length) {
+    makeOwned();
+    data.insert(data.end(), bytes, bytes + length);
+}
+
 void ByteStream::append(const ByteStream &other) {
-    data.insert(data.end(), other.data.begin(), other.data.end());
+    append(other.bytes(), other.size());
+}
+
+void ByteStream::reserve(unsigned size) {
+    makeOwned();
+    data.reserve(size);
 }
 
 void ByteStream::padTo(unsigned toMultiple) {
     if (toMultiple == 0) return;
+    makeOwned();
     while (data.size() == 0 || data.size() % toMultiple != 0) {
         data.push_back(0);
     }
 }
 
 uint8_t ByteStream::read_8(unsigned where) const {
-    if (where > data.size()) return 0;
-    return data[where];
+    if (where >= size()) return 0;
+    return bytes()[where];
 }
 
 uint16_t ByteStream::read_16(unsigned where) const {
-    if (where + 1 > data.size()) return 0;
-    uint32_t value = 0;
-    value |= data[where];
-    ++where;
-    value |= data[where] << 8;
-    return value;
+    return cursor(where).read_16();
 }
 
 uint32_t ByteStream::read_32(unsigned where) const {
-    if (where + 3 > data.size()) return 0;
-    uint32_t value = 0;
-    value |= data[where];
-    ++where;
-    value |= data[where] << 8;
-    ++where;
-    value |= data[where] << 16;
-    ++where;
-    value |= data[where] << 24;
-    return value;
+    return cursor(where).read_32();
 }
 
 void ByteStream::overwrite_8(unsigned where, uint32_t value) {
+    makeOwned();
     if (where >= data.size()) return;
     data[where] = value;
 }
 
 void ByteStream::overwrite_16(unsigned where, uint32_t value) {
-    if (where + 1 >= data.size()) return;
+    makeOwned();
+    if (where + 2 > data.size()) return;
     data[where]     = value & 0xFF;
     data[where + 1] = (value >> 8) & 0xFF;
 }
 
 void ByteStream::overwrite_32(unsigned where, uint32_t value) {
-    if (where + 3 >= data.size()) return;
+    makeOwned();
+    if (where + 4 > data.size()) return;
     data[where]     = value & 0xFF;
     data[where + 1] = (value >> 8) & 0xFF;
     data[where + 2] = (value >> 16) & 0xFF;
@@ -78,18 +95,23 @@ void ByteStream::overwrite_32(unsigned where, uint32_t value) {
 }
 
 unsigned ByteStream::size() const {
-    return data.size();
+    return external ? externalSize : data.size();
+}
+
+const uint8_t* ByteStream::bytes() const {
+    return external ? external : data.data();
 }
 
 void ByteStream::write(std::ostream &out) const {
-    out.write(reinterpret_cast<const char*>(data.data()), data.size());
+    out.write(reinterpret_cast<const char*>(bytes()), size());
 }
 
 void ByteStream::dump(std::ostream &out, int indentSize) const {
+    const uint8_t *raw = bytes();
     int oldFill = out.fill();
     out.fill('0');
     out << std::hex;
-    for (unsigned i = 0; i < data.size(); ++i) {
+    for (unsigned i = 0; i < size(); ++i) {
         if (i % 16 == 0) {
             out << '\n';
             for (int i = 0; i < indentSize; ++i) out << ' ';
@@ -97,7 +119,7 @@ void ByteStream::dump(std::ostream &out, int indentSize) const {
         } else if (i % 8 == 0) {
             out << "  ";
         }
-        out << ' ' << std::setw(2) << static_cast<int>(data[i]);
+        out << ' ' << std::setw(2) << static_cast<int>(raw[i]);
     }
     out << '\n' << std::dec;
     out.fill(oldFill);
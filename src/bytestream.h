@@ -1,16 +1,40 @@
 #ifndef BYTESTREAM_H
 #define BYTESTREAM_H
 
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <iosfwd>
+#include <string_view>
 #include <vector>
 
+#include "value.h"
+
+class ByteCursor;
+
+// The cursor's reads are the interpreter's operand decoding, so they are
+// inlined even in unoptimised builds.
+#if defined(__GNUC__)
+#define CURSOR_INLINE   __attribute__((always_inline)) inline
+#else
+#define CURSOR_INLINE   inline
+#endif
+
 class ByteStream {
 public:
+    ByteStream() : external(nullptr), externalSize(0) { }
+
+    // read from memory owned elsewhere (which must outlive the stream) rather
+    // than copying it; the stream makes its own copy if it is later modified
+    void view(const uint8_t *bytes, unsigned size);
+
     void add_8(uint8_t value);
     void add_16(uint16_t value);
     void add_32(uint32_t value);
+    void append(const uint8_t *bytes, size_t length);
     void append(const ByteStream &other);
+    // make room for the stream to grow to size bytes without reallocating
+    void reserve(unsigned size);
     void padTo(unsigned toMultiple);
     uint8_t read_8(unsigned where) const;
     uint16_t read_16(unsigned where) const;
@@ -19,11 +43,171 @@ public:
     void overwrite_16(unsigned where, uint32_t value);
     void overwrite_32(unsigned where, uint32_t value);
     unsigned size() const;
+    const uint8_t* bytes() const;
+    const uint8_t* begin() const {
+        return bytes();
+    }
+    const uint8_t* end() const {
+        return bytes() + size();
+    }
+    // read from where onwards; see ByteCursor
+    ByteCursor cursor(unsigned where = 0) const;
     void write(std::ostream &out) const;
 
     void dump(std::ostream &out, int indentSize = 0) const;
 private:
+    void makeOwned();
+
     std::vector<uint8_t> data;
+    const uint8_t *external;
+    unsigned externalSize;
 };
 
+// Reads little-endian fields from a ByteStream, or any other block of
+// memory, in order, moving past each. The read_ functions check that the
+// field lies within the stream and give zero if it doesn't, as ByteStream's
+// own do, and a cursor that has had to do so is no longer ok(). The next_
+// functions are for bytes already known to be there, such as the code of a
+// function that passed the verifier, and don't check at all. A cursor can
+// only be used while its stream is unchanged.
+class ByteCursor {
+public:
+    explicit ByteCursor(const ByteStream &stream, unsigned where = 0)
+    : start(stream.bytes()), size(stream.size()), pos(where), failed(false)
+    { }
+    ByteCursor(const uint8_t *bytes, size_t size)
+    : start(bytes), size(size), pos(0), failed(false)
+    { }
+
+    CURSOR_INLINE unsigned position() const {
+        return pos;
+    }
+    CURSOR_INLINE void seek(unsigned where) {
+        pos = where;
+    }
+    CURSOR_INLINE void skip(unsigned count) {
+        pos += count;
+    }
+    // whether the next count bytes lie within the stream
+    CURSOR_INLINE bool holds(unsigned count) const {
+        return pos <= size && count <= size - pos;
+    }
+    // whether every checked read so far lay within the stream
+    bool ok() const {
+        return !failed;
+    }
+    bool atEnd() const {
+        return pos == size;
+    }
+    // the next byte, as a pointer
+    const uint8_t* here() const {
+        return start + pos;
+    }
+
+    CURSOR_INLINE uint8_t read_8() {
+        uint8_t value = holds(1) ? start[pos] : fail();
+        pos += 1;
+        return value;
+    }
+    CURSOR_INLINE uint16_t read_16() {
+        uint16_t value = holds(2) ? load_16(start + pos) : fail();
+        pos += 2;
+        return value;
+    }
+    CURSOR_INLINE uint32_t read_32() {
+        uint32_t value = holds(4) ? load_32(start + pos) : fail();
+        pos += 4;
+        return value;
+    }
+    // the next byte, without moving past it
+    CURSOR_INLINE uint8_t peek_8() const {
+        return holds(1) ? start[pos] : 0;
+    }
+    // move past the next count bytes, returning where they start, or null
+    // if the stream is too short to hold them
+    const uint8_t* take(size_t count) {
+        if (!holds(0) || count > size - pos) {
+            failed = true;
+            return nullptr;
+        }
+        const uint8_t *taken = start + pos;
+        pos += count;
+        return taken;
+    }
+    // read the number of records in a section, failing if the rest of the
+    // stream is too short to hold that many records of at least minSize bytes
+    unsigned read_count(unsigned minSize) {
+        uint32_t count = read_32();
+        if (!holds(0) || count > (size - pos) / minSize) {
+            failed = true;
+            return 0;
+        }
+        return count;
+    }
+    std::string_view read_str() {
+        unsigned length = read_16();
+        const uint8_t *text = take(length);
+        if (!text) return std::string_view();
+        return std::string_view(reinterpret_cast<const char*>(text), length);
+    }
+    Value read_value() {
+        Value value;
+        value.type = static_cast<Value::Type>(read_8());
+        value.value = read_32();
+        return value;
+    }
+    // a value stored with a 32-bit type, as in version 1 gamefiles
+    Value read_aligned_value() {
+        Value value;
+        value.type = static_cast<Value::Type>(read_32());
+        value.value = read_32();
+        return value;
+    }
+
+    CURSOR_INLINE uint8_t next_8() {
+        return start[pos++];
+    }
+    CURSOR_INLINE uint16_t next_16() {
+        pos += 2;
+        return load_16(start + pos - 2);
+    }
+    CURSOR_INLINE uint32_t next_32() {
+        pos += 4;
+        return load_32(start + pos - 4);
+    }
+
+    static CURSOR_INLINE uint16_t load_16(const uint8_t *bytes) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        uint16_t value;
+        std::memcpy(&value, bytes, sizeof value);
+        return value;
+#else
+        return bytes[0] | bytes[1] << 8;
+#endif
+    }
+    static CURSOR_INLINE uint32_t load_32(const uint8_t *bytes) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        uint32_t value;
+        std::memcpy(&value, bytes, sizeof value);
+        return value;
+#else
+        return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+#endif
+    }
+private:
+    uint8_t fail() {
+        failed = true;
+        return 0;
+    }
+
+    const uint8_t *start;
+    size_t size;
+    unsigned pos;
+    bool failed;
+};
+
+inline ByteCursor ByteStream::cursor(unsigned where) const {
+    return ByteCursor(*this, where);
+}
+
 #endif
@@ -1,82 +1,136 @@
+#include <algorithm>
 #include <array>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <map>
 #include <vector>
 
 #include "gamedata.h"
+#include "opcode.h"
 #include "runtime_error.h"
 #include "runner.h"
 
-namespace Opcode {
-    enum Opcode {
-        Return       = 0,
-        Push0        = 1,
-        Push1        = 2,
-        PushNeg1     = 3,
-        Push8        = 4,
-        Push16       = 5,
-        Push32       = 6,
-        Store        = 7,
-        Say          = 10,
-        SayUnsigned  = 11,
-        SayChar      = 12,
-        StackPop     = 13, // remove the top item from the stack
-        StackDup     = 14, // duplicate the top item on the stack
-        StackPeek    = 15, // peek at the stack item X items from the top
-        StackSize    = 16, // get the current size of the stack
-        Call         = 17, // call a value as a function
-        CallMethod   = 18, // call an object property as a function
-        Self         = 19, // get object the current function is a property of
-        GetProp      = 20,
-        HasProp      = 21, // check if property is set on object
-        SetProp      = 22, // set object property to value
-        GetItem      = 23, // get item from list (index) or map (key)
-        HasItem      = 24, // check if index (for list) or key (for map) exists
-        GetSize      = 25, // get size of list or map
-        SetItem      = 26, // set item in list (by index) of map (by key)
-        TypeOf       = 27, // get value type
-        CompareTypes        = 30, // compare the types of two values and push the result
-        Compare             = 31, // compare two values and push the result
-        Jump                = 32, // unconditional jump
-        JumpZero            = 33, // jump if top of stack == 0
-        JumpNotZero         = 34, // jump if top of stack != 0
-        JumpLessThan        = 35, // jump if top of stack < 0
-        JumpLessThanEqual   = 36, // jump if top of stack <= 0
-        JumpGreaterThan     = 37, // jump if top of stack > 0
-        JumpGreaterThanEqual= 38, // jump if top of stack >= 0
-        Add          = 40,
-        Sub          = 41,
-        Mult         = 42,
-        Div          = 43,
-        WaitKey             = 50,
-    };
-};
-
-void dumpStack(const std::vector<Value> &stack) {
-    if (stack.empty()) {
+// Built with GCC or Clang, the interpreter jumps directly from the end of each
+// instruction's handler to the next one through a table of label addresses.
+// Elsewhere, or when built with USE_SWITCH_DISPATCH, it uses a plain switch.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(USE_SWITCH_DISPATCH)
+#define THREADED_DISPATCH
+#endif
+
+// Built with ENABLE_PROFILER, the interpreter reports each opcode executed and
+// each function entered and left to the profiler, if one has been enabled.
+// Otherwise the hooks compile to nothing.
+#ifdef ENABLE_PROFILER
+#define PROFILE(call)   do { if (profiler) profiler->call; } while (0)
+#else
+#define PROFILE(call)   do { } while (0)
+#endif
+
+#ifdef THREADED_DISPATCH
+#define DISPATCH_START  NEXT_OPCODE;
+#define DISPATCH_END
+#define CASE(name)      op_##name:
+#define DEFAULT_CASE    op_unknown:
+#define NEXT_OPCODE     opcode = READ_8(); PROFILE(countOpcode(opcode));    \
+                        goto *dispatchTable[opcode]
+#else
+#define DISPATCH_START  while (1) { opcode = READ_8();                     \
+                        PROFILE(countOpcode(opcode)); switch(opcode) {
+#define DISPATCH_END    } }
+#define CASE(name)      case Opcode::name:
+#define DEFAULT_CASE    default:
+#define NEXT_OPCODE     break
+#endif
+// Superinstructions only appear in the fused code that verified functions
+// run with, so anywhere else they are as unknown as any other opcode.
+#define FUSED_CASE(name)    CASE(name) if (checked) unknownOpcode(opcode, ip.position());
+
+// Functions that passed the verifier run with checked == false. Their bytecode
+// lies within the function, their stack never underflows or grows past
+// FunctionDef::maxStack, and their jump targets and store destinations are
+// constants known to be valid, so none of those things are checked.
+#define READ_8()    (checked ? ip.read_8() : ip.next_8())
+#define READ_16()   (checked ? ip.read_16() : ip.next_16())
+#define READ_32()   (checked ? ip.read_32() : ip.next_32())
+
+#define SAVE_STATE()    stackTop = sp - stack.data()
+#define LOAD_STATE()    do {                                    \
+        sp = stack.data() + stackTop;                           \
+        locals = stack.data() + frame->base;                    \
+        bottom = stack.data() + frame->stackBase;               \
+        limit = stack.data() + stack.size();                    \
+    } while (0)
+#define POP()           (checked && sp == bottom ? stackUnderflow() : *--sp)
+#define PUSH(...)       do {                                    \
+        Value pushed = (__VA_ARGS__);                           \
+        if (checked && sp == limit) {                           \
+            SAVE_STATE();                                       \
+            reserveStack(stackTop + 1);                         \
+            LOAD_STATE();                                       \
+        }                                                       \
+        *sp++ = pushed;                                         \
+    } while (0)
+#define READ_LOCAL(v)   readLocal((v), locals, bottom - locals)
+// Stops running with the current frame continuing from ip, so that resume
+// can carry on from there.
+#define SUSPEND(why)    do {                                    \
+        frame->ip = ip.position();                              \
+        SAVE_STATE();                                           \
+        status = (why);                                         \
+        return true;                                            \
+    } while (0)
+// Jumps to an offset within the current function. A backward jump uses up
+// one unit of the budget. When the JIT is enabled, it is also where a
+// verified function becomes hot enough to compile and where it goes back to
+// compiled code after the interpreter has run an instruction the compiled
+// code couldn't.
+#define JUMP_TO(target) do {                                    \
+        unsigned from = ip.position();                          \
+        ip.seek(frame->function->position + (target));          \
+        if (ip.position() < from) {                             \
+            if (--budget < 0) SUSPEND(RunStatus::OutOfBudget);  \
+            if (!checked && compiler                            \
+                    && compiler->noteBackEdge(*frame->function)) {  \
+                frame->ip = ip.position();                      \
+                SAVE_STATE();                                   \
+                return false;                                   \
+            }                                                   \
+        }                                                       \
+    } while (0)
+
+void dumpStack(const Value *bottom, const Value *top) {
+    if (bottom == top) {
         std::cout << "(stack empty)\n";
         return;
     }
     std::cout << '\n';
-    for (unsigned i = 0; i < stack.size(); ++i) {
-        std::cout << i << ": " << stack[i] << '\n';
+    for (unsigned i = 0; bottom + i < top; ++i) {
+        std::cout << i << ": " << bottom[i] << '\n';
     }
 }
 
-Value popStack(std::vector<Value> &stack) {
-    if (stack.empty()) {
-        throw RuntimeError("Stack underflow.");
-    }
-    Value v = stack.back();
-    stack.pop_back();
-    return v;
+static Value stackUnderflow() {
+    throw RuntimeError("Stack underflow.");
+}
+
+static void unknownOpcode(int opcode, unsigned ip) {
+    std::stringstream ss;
+    ss << "Unknown opcode " << opcode << " at code position " << ip << '.';
+    throw RuntimeError(ss.str());
 }
 
-Value readLocal(const Value &value, const std::vector<Value> locals) {
+static void compareTypeError(const Value &v1, const Value &v2) {
+    std::stringstream ss;
+    ss << "Tried to compare values of different types (";
+    ss << v1.type << " and " << v2.type << ").";
+    throw RuntimeError(ss.str());
+}
+
+static inline Value readLocal(const Value &value, const Value *locals, int localCount) {
     if (value.type == Value::LocalVar) {
-        if (value.value < 0 || value.value >= static_cast<int>(locals.size())) {
+        if (value.value < 0 || value.value >= localCount) {
             std::stringstream ss;
             ss << "Tried to access non-existant local ";
             ss << value.value << '.';
@@ -87,6 +141,12 @@ Value readLocal(const Value &value, const std::vector<Value> locals) {
     return value;
 }
 
+static void containerTypeError(const std::string &source, const Value &value) {
+    std::stringstream ss;
+    ss << source << ": expected value of type List or Map, but found " << value.type << '.';
+    throw RuntimeError(ss.str());
+}
+
 void requireType(const std::string &source, const Value &value, const Value::Type &type) {
     if (value.type != type) {
         std::stringstream ss;
@@ -97,296 +157,840 @@ void requireType(const std::string &source, const Value &value, const Value::Typ
 
 
 Value Runner::callFunction(int ident, const std::vector<Value> &arguments) {
-    const FunctionDef &function = data.getFunction(ident);
-    const ByteStream &code = data.bytecode;
+    const FunctionDef &function = data->getFunction(ident);
+    if (arguments.size() > static_cast<unsigned>(function.arg_count)) {
+        throw RuntimeError("Too many arguments to function.");
+    }
+
+    unsigned entryDepth = frames.size();
+    unsigned entryTop = stackTop;
+    reserveStack(stackTop + arguments.size());
+    std::copy(arguments.begin(), arguments.end(), stack.begin() + stackTop);
+    stackTop += arguments.size();
+    enterFunction(function, arguments.size());
+
+    // this may be called while a started function is suspended, which must
+    // find its budget and status as it left them
+    int64_t savedBudget = budget;
+    bool savedSuspendable = suspendable;
+    RunStatus savedStatus = status;
+    budget = unlimited;
+    suspendable = false;
+    Value result;
+    try {
+        execute(entryDepth, result);
+    } catch (...) {
+        PROFILE(unwind(entryDepth));
+        frames.resize(entryDepth);
+        stackTop = entryTop;
+        budget = savedBudget;
+        suspendable = savedSuspendable;
+        status = savedStatus;
+        throw;
+    }
+    budget = savedBudget;
+    suspendable = savedSuspendable;
+    status = savedStatus;
+    return result;
+}
 
+void Runner::start(int ident, const std::vector<Value> &arguments) {
+    if (!frames.empty()) {
+        throw RuntimeError("Tried to start a function while another is running.");
+    }
+    const FunctionDef &function = data->getFunction(ident);
     if (arguments.size() > static_cast<unsigned>(function.arg_count)) {
         throw RuntimeError("Too many arguments to function.");
     }
 
-    std::vector<Value> locals(function.arg_count + function.local_count);
-    std::vector<Value> stack;
+    stackTop = 0;
+    reserveStack(arguments.size());
+    std::copy(arguments.begin(), arguments.end(), stack.begin());
+    stackTop = arguments.size();
+    enterFunction(function, arguments.size());
+    lastResult = Value{};
+    status = RunStatus::Ready;
+}
+
+RunStatus Runner::resume(int64_t steps) {
+    if (status != RunStatus::Ready && status != RunStatus::OutOfBudget) {
+        throw RuntimeError("Tried to resume a function that cannot continue.");
+    }
+
+    budget = steps;
+    suspendable = true;
+    try {
+        execute(0, lastResult);
+    } catch (...) {
+        PROFILE(unwind(0));
+        frames.clear();
+        stackTop = 0;
+        budget = unlimited;
+        suspendable = false;
+        status = RunStatus::Finished;
+        throw;
+    }
+    budget = unlimited;
+    suspendable = false;
+    output.flush();
+    return status;
+}
+
+static Value keyValue(const std::string &word) {
+    if (word.empty()) return Value{Value::None, 0};
+    return Value{Value::Integer, word[0]};
+}
+
+void Runner::giveKey(const std::string &word) {
+    if (status != RunStatus::WaitingForKey) {
+        throw RuntimeError("Tried to give a key to a function not waiting for one.");
+    }
+    // WaitKey's result goes where it would have pushed it
+    reserveStack(stackTop + 1);
+    stack[stackTop++] = keyValue(word);
+    status = RunStatus::Ready;
+}
+
+void Runner::resetPropertyCache() {
+    // the cache is indexed by code position, so size it with the bytecode to
+    // keep collisions between GetProp instructions rare
+    unsigned size = 256;
+    while (size < data->bytecode.size() / 16 && size < 65536) {
+        size *= 2;
+    }
+    propertyCache.assign(size, PropertyCacheEntry{0, 0, nullptr, Shape::noSlot});
+    propertyCacheMask = size - 1;
+}
+
+void Runner::reserveStack(unsigned needed) {
+    if (needed > stack.size()) {
+        stack.resize(std::max<size_t>(needed, stack.size() * 2));
+    }
+}
+
+// make a new list, map or object, first doing a share of the collection in
+// progress, if any, or starting one if enough has been made since the last
+Value Runner::make(Value::Type type) {
+    if (!heap.collecting() && heap.collectionDue()) {
+        heap.startCollection();
+        markRoots();
+    }
+    if (heap.collecting()) heap.collect(Heap::workPerMake);
+    return heap.make(type);
+}
+
+void Runner::markRoots() {
+    for (unsigned i = 0; i < stackTop; ++i) {
+        heap.markRoot(stack[i]);
+    }
+    heap.markRoot(lastResult);
+    for (const Checkpoint &saved : checkpoints) {
+        for (const Value &value : saved.stack) {
+            heap.markRoot(value);
+        }
+        heap.markRoot(saved.lastResult);
+    }
+}
+
+void Runner::collectGarbage() {
+    if (!heap.collecting()) {
+        heap.startCollection();
+        markRoots();
+    }
+    while (heap.collecting()) {
+        heap.collect(std::numeric_limits<unsigned>::max());
+    }
+}
+
+void Runner::pushFrame(const FunctionDef &function, unsigned argCount) {
+    Frame frame;
+    frame.function = &function;
+    frame.ip = function.position;
+    frame.base = stackTop - argCount;
+    frame.stackBase = frame.base + function.arg_count + function.local_count;
+    // make room for the working stack if the verifier bounded it, and
+    // always for the value the function will return
+    reserveStack(frame.stackBase + function.maxStack + 1);
+    std::fill(stack.begin() + stackTop, stack.begin() + frame.stackBase, Value{});
+    stackTop = frame.stackBase;
+    frames.push_back(frame);
+}
+
+void Runner::enterFunction(const FunctionDef &function, unsigned argCount) {
+    pushFrame(function, argCount);
+    PROFILE(enter(&function));
+}
 
-    for (unsigned i = 0; i < arguments.size() && i < locals.size(); ++i) {
-        locals[i] = arguments[i];
+// Calls a function in place of the running one, which was about to return
+// whatever the call returned. Its arguments, on top of the stack, take the
+// place of its caller's locals, so a chain of such calls runs in constant
+// space however long it is.
+void Runner::enterTailCall(const FunctionDef &function, unsigned argCount) {
+    unsigned base = frames.back().base;
+    std::copy(stack.begin() + stackTop - argCount, stack.begin() + stackTop,
+              stack.begin() + base);
+    stackTop = base + argCount;
+    PROFILE(tailCall(&function));
+    frames.pop_back();
+    pushFrame(function, argCount);
+}
+
+// Runs frames until the one at entryDepth returns, storing its return value
+// in result, or until execution suspends. Returns the status saying which.
+RunStatus Runner::execute(unsigned entryDepth, Value &result) {
+    status = RunStatus::Finished;
+    while (1) {
+        bool stopped;
+        if (jit && !reference && runCompiled(entryDepth, result)) return status;
+        if (frames.back().function->verified && !reference) {
+            stopped = run<false>(entryDepth, result);
+        } else {
+            stopped = run<true>(entryDepth, result);
+        }
+        if (stopped) return status;
     }
+}
+
+// Runs compiled code for as long as the current frame has some, making calls
+// and returns between compiled functions here rather than in the interpreter.
+// Returns true if the frame at entryDepth returns, with its return value in
+// result, or execution suspends, or false once there is an instruction for
+// the interpreter to run.
+bool Runner::runCompiled(unsigned entryDepth, Value &result) {
+    while (1) {
+        Frame &frame = frames.back();
+        JitContext context{stack.data() + stackTop, stack.data() + frame.base, nullptr,
+                           frame.ip, budget};
+        if (!frame.function->verified || !jit->run(*frame.function, context)) return false;
+        stackTop = context.sp - stack.data();
+        frame.ip = context.ip;
+        budget = context.budget;
+
+        Value *sp = stack.data() + stackTop;
+        int opcode = data->bytecode.read_8(frame.ip);
+        if (opcode == Opcode::Call) {
+            // the verifier has proven the argument count to be a constant
+            // within the stack; anything else that could go wrong is left for
+            // the interpreter to report
+            Value functionId = sp[-1];
+            unsigned count = sp[-2].value > 0 ? sp[-2].value : 0;
+            if (functionId.type != Value::Node) return false;
+            const FunctionDef *callee = data->functions.find(functionId.value);
+            if (!callee || count > static_cast<unsigned>(callee->arg_count)) return false;
+            stackTop -= 2;
+            std::reverse(sp - 2 - count, sp - 2);
+            frame.ip += 1;
+            if (data->bytecode.read_8(frame.ip) == Opcode::Return) {
+                enterTailCall(*callee, count);
+            } else {
+                enterFunction(*callee, count);
+            }
+            if (callee->verified) jit->noteCall(*callee);
+            if (--budget < 0) {
+                status = RunStatus::OutOfBudget;
+                return true;
+            }
+        } else if (opcode == Opcode::Return) {
+            Value returnValue = Value{Value::Integer, 0};
+            if (sp > stack.data() + frame.stackBase) {
+                returnValue = sp[-1];
+            }
+            stackTop = frame.base;
+            PROFILE(leave());
+            frames.pop_back();
+            if (frames.size() == entryDepth) {
+                result = returnValue;
+                return true;
+            }
+            // the returning frame's space always holds the return value
+            stack[stackTop++] = returnValue;
+        } else {
+            return false;
+        }
+    }
+}
 
-    unsigned ip = function.position;
+// Runs frames until the one at entryDepth returns, in which case its return
+// value is stored in result and true is returned, or until control passes to
+// a function that needs the other variant of this loop. Also returns true if
+// execution suspends, with status set to why.
+template<bool checked>
+bool Runner::run(unsigned entryDepth, Value &result) {
+    const ByteStream &code = checked || !fusion ? data->bytecode : data->fusedCode;
+    Frame *frame = &frames.back();
+    ByteCursor ip = code.cursor(frame->ip);
+    Value *sp, *locals, *bottom, *limit;
+    Jit *const compiler = jit.get();
+    LOAD_STATE();
     int opcode, intValue;
     Value::Type type;
     Value value;
-    while (1) {
-        opcode = code.read_8(ip++);
-        switch(opcode) {
-            case Opcode::Return:
-                if (stack.empty()) {
-                    return Value{Value::Integer, 0};
-                } else {
-                    return stack.back();
+
+#ifdef THREADED_DISPATCH
+    // filled in once per thread, since control passes in and out of this
+    // function often when it is mixed with the other variant or the JIT
+    static thread_local void *dispatchTable[256];
+    static thread_local bool dispatchTableReady = false;
+    if (!dispatchTableReady) {
+        std::fill(std::begin(dispatchTable), std::end(dispatchTable), &&op_unknown);
+#define HANDLER(name) dispatchTable[Opcode::name] = &&op_##name
+        HANDLER(Return);        HANDLER(Push0);         HANDLER(Push1);
+        HANDLER(PushNeg1);      HANDLER(Push8);         HANDLER(Push16);
+        HANDLER(Push32);        HANDLER(Store);         HANDLER(Say);
+        HANDLER(SayUnsigned);   HANDLER(StackPop);      HANDLER(StackDup);
+        HANDLER(StackPeek);     HANDLER(StackSize);     HANDLER(Call);
+        HANDLER(GetProp);       HANDLER(HasProp);       HANDLER(SetProp);
+        HANDLER(GetItem);       HANDLER(HasItem);
+        HANDLER(GetSize);       HANDLER(SetItem);
+        HANDLER(CompareTypes);  HANDLER(Compare);
+        HANDLER(Jump);          HANDLER(JumpZero);      HANDLER(JumpNotZero);
+        HANDLER(JumpLessThan);  HANDLER(JumpLessThanEqual);
+        HANDLER(JumpGreaterThan);                       HANDLER(JumpGreaterThanEqual);
+        HANDLER(Add);           HANDLER(Sub);           HANDLER(Mult);
+        HANDLER(Div);           HANDLER(WaitKey);
+        HANDLER(NewList);       HANDLER(NewMap);        HANDLER(NewObject);
+        HANDLER(PushJump);              HANDLER(PushJumpZero);
+        HANDLER(PushJumpNotZero);       HANDLER(PushJumpLessThan);
+        HANDLER(PushJumpLessThanEqual); HANDLER(PushJumpGreaterThan);
+        HANDLER(PushJumpGreaterThanEqual);
+        HANDLER(CompareJumpZero);       HANDLER(CompareJumpNotZero);
+        HANDLER(CompareJumpLessThan);   HANDLER(CompareJumpLessThanEqual);
+        HANDLER(CompareJumpGreaterThan);
+        HANDLER(CompareJumpGreaterThanEqual);
+        HANDLER(AddImmediate);  HANDLER(SubImmediate);
+        HANDLER(AddLocal);      HANDLER(SubLocal);      HANDLER(StoreLocal);
+        HANDLER(PushJump8);             HANDLER(PushJumpZero8);
+        HANDLER(PushJumpNotZero8);      HANDLER(PushJumpLessThan8);
+        HANDLER(PushJumpLessThanEqual8);HANDLER(PushJumpGreaterThan8);
+        HANDLER(PushJumpGreaterThanEqual8);
+        HANDLER(CompareJumpZero8);      HANDLER(CompareJumpNotZero8);
+        HANDLER(CompareJumpLessThan8);  HANDLER(CompareJumpLessThanEqual8);
+        HANDLER(CompareJumpGreaterThan8);
+        HANDLER(CompareJumpGreaterThanEqual8);
+#undef HANDLER
+        dispatchTableReady = true;
+    }
+#endif
+
+    DISPATCH_START
+            CASE(Return) {
+                Value returnValue = Value{Value::Integer, 0};
+                if (sp > bottom) {
+                    returnValue = sp[-1];
                 }
-                break;
-            case Opcode::Push0:
-                type = static_cast<Value::Type>(code.read_8(ip++));
-                stack.push_back(Value{type, 0});
-                break;
-            case Opcode::Push1:
-                type = static_cast<Value::Type>(code.read_8(ip++));
-                stack.push_back(Value{type, 1});
-                break;
-            case Opcode::PushNeg1:
-                type = static_cast<Value::Type>(code.read_8(ip++));
-                stack.push_back(Value{type, -1});
-                break;
-            case Opcode::Push8:
-                type = static_cast<Value::Type>(code.read_8(ip++));
-                intValue = code.read_8(ip++);
+                stackTop = frame->base;
+                PROFILE(leave());
+                frames.pop_back();
+                if (frames.size() == entryDepth) {
+                    result = returnValue;
+                    return true;
+                }
+                frame = &frames.back();
+                LOAD_STATE();
+                PUSH(returnValue);
+                ip.seek(frame->ip);
+                if (frame->function->verified == checked
+                        || (!checked && compiler && compiler->isCompiled(*frame->function))) {
+                    SAVE_STATE();
+                    return false;
+                }
+                NEXT_OPCODE;
+            }
+            CASE(Push0)
+                type = static_cast<Value::Type>(READ_8());
+                PUSH(Value{type, 0});
+                NEXT_OPCODE;
+            CASE(Push1)
+                type = static_cast<Value::Type>(READ_8());
+                PUSH(Value{type, 1});
+                NEXT_OPCODE;
+            CASE(PushNeg1)
+                type = static_cast<Value::Type>(READ_8());
+                PUSH(Value{type, -1});
+                NEXT_OPCODE;
+            CASE(Push8)
+                type = static_cast<Value::Type>(READ_8());
+                intValue = READ_8();
                 if (intValue & 0x80) intValue |= 0xFFFFFF00;
-                stack.push_back(Value{type, intValue});
-                break;
-            case Opcode::Push16:
-                type = static_cast<Value::Type>(code.read_8(ip++));
-                intValue = code.read_16(ip);
+                PUSH(Value{type, intValue});
+                NEXT_OPCODE;
+            CASE(Push16)
+                type = static_cast<Value::Type>(READ_8());
+                intValue = READ_16();
                 if (intValue & 0x8000) intValue |= 0xFFFF0000;
-                ip += 2;
-                stack.push_back(Value{type, intValue});
-                break;
-            case Opcode::Push32:
-                type = static_cast<Value::Type>(code.read_8(ip++));
-                intValue = code.read_32(ip);
-                ip += 4;
-                stack.push_back(Value{type, intValue});
-                break;
-            case Opcode::Store: {
-                Value localId = popStack(stack);
-                Value value = popStack(stack);
-                requireType("store/local-id", localId, Value::LocalVar);
-                if (localId.value < 0 || localId.value >= static_cast<int>(locals.size())) {
-                    throw RuntimeError("Tried to store to non-existant local number.");
+                PUSH(Value{type, intValue});
+                NEXT_OPCODE;
+            CASE(Push32)
+                type = static_cast<Value::Type>(READ_8());
+                intValue = READ_32();
+                PUSH(Value{type, intValue});
+                NEXT_OPCODE;
+            CASE(Store) {
+                Value localId = POP();
+                Value value = POP();
+                if (checked) {
+                    requireType("store/local-id", localId, Value::LocalVar);
+                    if (localId.value < 0 || localId.value >= bottom - locals) {
+                        throw RuntimeError("Tried to store to non-existant local number.");
+                    }
                 }
                 locals[localId.value] = value;
-                break;
+                NEXT_OPCODE;
             }
 
-            case Opcode::Say:
-                value = popStack(stack);
-                value = readLocal(value, locals);
+            CASE(Say)
+                value = POP();
+                value = READ_LOCAL(value);
                 say(value);
-                break;
-            case Opcode::SayUnsigned:
-                value = popStack(stack);
-                value = readLocal(value, locals);
+                NEXT_OPCODE;
+            CASE(SayUnsigned)
+                value = POP();
+                value = READ_LOCAL(value);
                 requireType("say-unsigned/value", value, Value::Integer);
                 say(static_cast<unsigned>(value.value));
-                break;
+                NEXT_OPCODE;
 
-            case Opcode::StackPop: {
-                popStack(stack);
-                break;
+            CASE(StackPop) {
+                POP();
+                NEXT_OPCODE;
             }
-            case Opcode::StackDup: {
-                if (stack.empty()) throw RuntimeError("Stack underflow.");
-                stack.push_back(stack.back());
-                break;
+            CASE(StackDup) {
+                if (checked && sp == bottom) stackUnderflow();
+                PUSH(sp[-1]);
+                NEXT_OPCODE;
             }
-            case Opcode::StackPeek: {
-                Value depth = popStack(stack);
+            CASE(StackPeek) {
+                Value depth = POP();
                 requireType("stack-peek/depth", depth, Value::Integer);
-                if (depth.value >= static_cast<int>(stack.size())) throw RuntimeError("stack-peek: tried to peek beyond bottom of stack.");
-                stack.push_back(stack[depth.value]);
-                break;
-            }
-            case Opcode::StackSize: {
-                int stackSize = stack.size();
-                stack.push_back(Value{Value::Integer, stackSize});
-                break;
-            }
-
-            case Opcode::Call: {
-                Value functionId = popStack(stack);
-                Value argCount = popStack(stack);
-                requireType("call/arg-count", argCount, Value::Integer);
-                std::vector<Value> args;
-                for (int i = 0; i < argCount.value; ++i) {
-                    args.push_back(popStack(stack));
+                if (depth.value < 0 || depth.value >= sp - bottom) throw RuntimeError("stack-peek: tried to peek beyond bottom of stack.");
+                PUSH(bottom[depth.value]);
+                NEXT_OPCODE;
+            }
+            CASE(StackSize) {
+                int stackSize = sp - bottom;
+                PUSH(Value{Value::Integer, stackSize});
+                NEXT_OPCODE;
+            }
+
+            CASE(Call) {
+                Value functionId = POP();
+                Value argCount = POP();
+                if (checked) {
+                    requireType("call/arg-count", argCount, Value::Integer);
                 }
-                Value result;
-                switch(functionId.type) {
-                    case Value::Node:
-                        result = callFunction(functionId.value, args);
-                        break;
-                    default:
-                        std::stringstream ss;
-                        ss << "Value type " << functionId.type << " not callable.";
-                        throw RuntimeError(ss.str());
+                unsigned count = argCount.value > 0 ? argCount.value : 0;
+                if (checked && count > static_cast<unsigned>(sp - bottom)) {
+                    stackUnderflow();
+                }
+                if (functionId.type != Value::Node) {
+                    std::stringstream ss;
+                    ss << "Value type " << functionId.type << " not callable.";
+                    throw RuntimeError(ss.str());
+                }
+                const FunctionDef &callee = data->getFunction(functionId.value);
+                if (count > static_cast<unsigned>(callee.arg_count)) {
+                    throw RuntimeError("Too many arguments to function.");
                 }
-                stack.push_back(result);
-                break;
+                // arguments were pushed last-to-first, so flip them in place to
+                // make them the start of the callee's locals
+                std::reverse(sp - count, sp);
+                frame->ip = ip.position();
+                SAVE_STATE();
+                if (ip.peek_8() == Opcode::Return) {
+                    enterTailCall(callee, count);
+                } else {
+                    enterFunction(callee, count);
+                }
+                if (--budget < 0) {
+                    status = RunStatus::OutOfBudget;
+                    return true;
+                }
+                if (callee.verified == checked
+                        || (compiler && callee.verified && compiler->noteCall(callee))) {
+                    return false;
+                }
+                frame = &frames.back();
+                LOAD_STATE();
+                ip.seek(frame->ip);
+                NEXT_OPCODE;
             }
 
-            case Opcode::GetProp: {
-                Value objectId = readLocal(popStack(stack), locals);
-                Value propId = readLocal(popStack(stack), locals);
+            CASE(GetProp) {
+                Value objectId = READ_LOCAL(POP());
+                Value propId = READ_LOCAL(POP());
                 requireType("get-prop/object-id", objectId, Value::Object);
                 requireType("get-prop/prop-id", propId, Value::Property);
-                const ObjectDef &object = data.getObject(objectId.value);
-                auto propertyIter = object.properties.find(propId.value);
-                if (propertyIter == object.properties.end()) {
-                    stack.push_back(Value{Value::Integer, 0});
+                const ObjectDef &object = heap.getObject(objectId.value);
+                PropertyCacheEntry &cache = propertyCache[ip.position() & propertyCacheMask];
+                if (cache.site != ip.position() || cache.shape != object.shape
+                        || cache.propId != static_cast<unsigned>(propId.value)) {
+                    cache.site = ip.position();
+                    cache.propId = propId.value;
+                    cache.shape = object.shape;
+                    cache.slot = object.shape->slotOf(propId.value);
+                }
+                if (cache.slot == Shape::noSlot) {
+                    PUSH(Value{Value::Integer, 0});
                 } else {
-                    stack.push_back(propertyIter->second);
+                    PUSH(object.slots[cache.slot]);
                 }
-                break;
+                NEXT_OPCODE;
+            }
+            CASE(HasProp) {
+                Value objectId = READ_LOCAL(POP());
+                Value propId = READ_LOCAL(POP());
+                requireType("has-prop/object-id", objectId, Value::Object);
+                requireType("has-prop/prop-id", propId, Value::Property);
+                const ObjectDef &object = heap.getObject(objectId.value);
+                bool found = object.shape->slotOf(propId.value) != Shape::noSlot;
+                PUSH(Value{Value::Integer, found ? 1 : 0});
+                NEXT_OPCODE;
+            }
+            CASE(SetProp) {
+                Value objectId = READ_LOCAL(POP());
+                Value propId = READ_LOCAL(POP());
+                Value value = READ_LOCAL(POP());
+                requireType("set-prop/object-id", objectId, Value::Object);
+                requireType("set-prop/prop-id", propId, Value::Property);
+                heap.setProperty(objectId.value, propId.value, value);
+                NEXT_OPCODE;
             }
 
-            case Opcode::CompareTypes: {
-                Value v1 = readLocal(popStack(stack), locals);
-                Value v2 = readLocal(popStack(stack), locals);
-                if (v1.type != v2.type) {
-                    stack.push_back(Value{Value::Integer, 1});
+            CASE(GetItem) {
+                Value container = READ_LOCAL(POP());
+                Value key = READ_LOCAL(POP());
+                if (container.type == Value::List) {
+                    requireType("get-item/index", key, Value::Integer);
+                    const std::vector<Value> &items = heap.getList(container.value);
+                    if (key.value < 0 || key.value >= static_cast<int>(items.size())) {
+                        PUSH(Value{Value::Integer, 0});
+                    } else {
+                        PUSH(items[key.value]);
+                    }
+                } else if (container.type == Value::Map) {
+                    const Value *item = heap.getMap(container.value).find(key);
+                    PUSH(item ? *item : Value{Value::Integer, 0});
                 } else {
-                    stack.push_back(Value{Value::Integer, 0});
+                    containerTypeError("get-item/container", container);
                 }
-                break;
+                NEXT_OPCODE;
             }
-            case Opcode::Compare: {
-                Value v1 = readLocal(popStack(stack), locals);
-                Value v2 = readLocal(popStack(stack), locals);
+            CASE(HasItem) {
+                Value container = READ_LOCAL(POP());
+                Value key = READ_LOCAL(POP());
+                bool found = false;
+                if (container.type == Value::List) {
+                    requireType("has-item/index", key, Value::Integer);
+                    const std::vector<Value> &items = heap.getList(container.value);
+                    found = key.value >= 0 && key.value < static_cast<int>(items.size());
+                } else if (container.type == Value::Map) {
+                    found = heap.getMap(container.value).find(key) != nullptr;
+                } else {
+                    containerTypeError("has-item/container", container);
+                }
+                PUSH(Value{Value::Integer, found ? 1 : 0});
+                NEXT_OPCODE;
+            }
+            CASE(GetSize) {
+                Value container = READ_LOCAL(POP());
+                int size = 0;
+                if (container.type == Value::List) {
+                    size = heap.getList(container.value).size();
+                } else if (container.type == Value::Map) {
+                    size = heap.getMap(container.value).size();
+                } else {
+                    containerTypeError("get-size/container", container);
+                }
+                PUSH(Value{Value::Integer, size});
+                NEXT_OPCODE;
+            }
+            CASE(SetItem) {
+                Value container = READ_LOCAL(POP());
+                Value key = READ_LOCAL(POP());
+                Value value = READ_LOCAL(POP());
+                if (container.type == Value::List) {
+                    requireType("set-item/index", key, Value::Integer);
+                    std::vector<Value> &items = heap.writableList(container.value);
+                    if (key.value >= 0 && key.value < static_cast<int>(items.size())) {
+                        items[key.value] = value;
+                    } else if (key.value == static_cast<int>(items.size())) {
+                        items.push_back(value);
+                    } else {
+                        std::stringstream ss;
+                        ss << "set-item: list index " << key.value << " out of range.";
+                        throw RuntimeError(ss.str());
+                    }
+                } else if (container.type == Value::Map) {
+                    heap.writableMap(container.value).set(key, value);
+                } else {
+                    containerTypeError("set-item/container", container);
+                }
+                NEXT_OPCODE;
+            }
+
+            CASE(CompareTypes) {
+                Value v1 = READ_LOCAL(POP());
+                Value v2 = READ_LOCAL(POP());
                 if (v1.type != v2.type) {
-                    std::stringstream ss;
-                    ss << "Tried to compare values of different types (";
-                    ss << v1.type << " and " << v2.type << ").";
-                    throw RuntimeError(ss.str());
+                    PUSH(Value{Value::Integer, 1});
+                } else {
+                    PUSH(Value{Value::Integer, 0});
                 }
-                Value result = Value{Value::Integer};
-                result.value = v2.value - v1.value;
-                stack.push_back(result);
-                break;
-            }
-
-            case Opcode::Jump: {
-                Value target = readLocal(popStack(stack), locals);
-                requireType("jmp/target", target, Value::JumpTarget);
-                ip = function.position + target.value;
-                break;
-            }
-            case Opcode::JumpZero: {
-                Value target = readLocal(popStack(stack), locals);
-                Value value = readLocal(popStack(stack), locals);
-                requireType("jz/target", target, Value::JumpTarget);
+                NEXT_OPCODE;
+            }
+            CASE(Compare) {
+                Value v1 = READ_LOCAL(POP());
+                Value v2 = READ_LOCAL(POP());
+                if (v1.type != v2.type) compareTypeError(v1, v2);
+                Value difference = Value{Value::Integer, 0};
+                difference.value = v2.value - v1.value;
+                PUSH(difference);
+                NEXT_OPCODE;
+            }
+
+            CASE(Jump) {
+                Value target = checked ? READ_LOCAL(POP()) : POP();
+                if (checked) requireType("jmp/target", target, Value::JumpTarget);
+                JUMP_TO(target.value);
+                NEXT_OPCODE;
+            }
+            CASE(JumpZero) {
+                Value target = checked ? READ_LOCAL(POP()) : POP();
+                Value value = READ_LOCAL(POP());
+                if (checked) requireType("jz/target", target, Value::JumpTarget);
                 if (value.value == 0) {
-                    ip = function.position + target.value;
+                    JUMP_TO(target.value);
                 }
-                break;
+                NEXT_OPCODE;
             }
-            case Opcode::JumpNotZero: {
-                Value target = readLocal(popStack(stack), locals);
-                Value value = readLocal(popStack(stack), locals);
-                requireType("jnz/target", target, Value::JumpTarget);
+            CASE(JumpNotZero) {
+                Value target = checked ? READ_LOCAL(POP()) : POP();
+                Value value = READ_LOCAL(POP());
+                if (checked) requireType("jnz/target", target, Value::JumpTarget);
                 if (value.value != 0) {
-                    ip = function.position + target.value;
+                    JUMP_TO(target.value);
                 }
-                break;
+                NEXT_OPCODE;
             }
-            case Opcode::JumpLessThan: {
-                Value target = readLocal(popStack(stack), locals);
-                Value value = readLocal(popStack(stack), locals);
-                requireType("jlt/target", target, Value::JumpTarget);
+            CASE(JumpLessThan) {
+                Value target = checked ? READ_LOCAL(POP()) : POP();
+                Value value = READ_LOCAL(POP());
+                if (checked) requireType("jlt/target", target, Value::JumpTarget);
                 if (value.value < 0) {
-                    ip = function.position + target.value;
+                    JUMP_TO(target.value);
                 }
-                break;
+                NEXT_OPCODE;
             }
-            case Opcode::JumpLessThanEqual: {
-                Value target = readLocal(popStack(stack), locals);
-                Value value = readLocal(popStack(stack), locals);
-                requireType("jlte/target", target, Value::JumpTarget);
+            CASE(JumpLessThanEqual) {
+                Value target = checked ? READ_LOCAL(POP()) : POP();
+                Value value = READ_LOCAL(POP());
+                if (checked) requireType("jlte/target", target, Value::JumpTarget);
                 if (value.value <= 0) {
-                    ip = function.position + target.value;
+                    JUMP_TO(target.value);
                 }
-                break;
+                NEXT_OPCODE;
             }
-            case Opcode::JumpGreaterThan: {
-                Value target = readLocal(popStack(stack), locals);
-                Value value = readLocal(popStack(stack), locals);
-                requireType("jgt/target", target, Value::JumpTarget);
+            CASE(JumpGreaterThan) {
+                Value target = checked ? READ_LOCAL(POP()) : POP();
+                Value value = READ_LOCAL(POP());
+                if (checked) requireType("jgt/target", target, Value::JumpTarget);
                 if (value.value > 0) {
-                    ip = function.position + target.value;
+                    JUMP_TO(target.value);
                 }
-                break;
+                NEXT_OPCODE;
             }
-            case Opcode::JumpGreaterThanEqual: {
-                Value target = readLocal(popStack(stack), locals);
-                Value value = readLocal(popStack(stack), locals);
-                requireType("jgte/target", target, Value::JumpTarget);
+            CASE(JumpGreaterThanEqual) {
+                Value target = checked ? READ_LOCAL(POP()) : POP();
+                Value value = READ_LOCAL(POP());
+                if (checked) requireType("jgte/target", target, Value::JumpTarget);
                 if (value.value >= 0) {
-                    ip = function.position + target.value;
+                    JUMP_TO(target.value);
                 }
-                break;
+                NEXT_OPCODE;
             }
 
-            case Opcode::Add: {
-                Value v1 = stack.back(); stack.pop_back();
-                Value v2 = stack.back();
-                v1 = readLocal(v1, locals);
-                v2 = readLocal(v2, locals);
+            CASE(Add) {
+                Value v1 = POP();
+                Value v2 = POP();
+                v1 = READ_LOCAL(v1);
+                v2 = READ_LOCAL(v2);
                 requireType("add/value-1", v1, Value::Integer);
                 requireType("add/value-2", v2, Value::Integer);
                 v2.value += v1.value;
-                stack[stack.size() - 1] = v2;
-                break;
-            }
-            case Opcode::Sub: {
-                Value v1 = stack.back(); stack.pop_back();
-                Value v2 = stack.back();
-                v1 = readLocal(v1, locals);
-                v2 = readLocal(v2, locals);
+                PUSH(v2);
+                NEXT_OPCODE;
+            }
+            CASE(Sub) {
+                Value v1 = POP();
+                Value v2 = POP();
+                v1 = READ_LOCAL(v1);
+                v2 = READ_LOCAL(v2);
                 requireType("sub/value-1", v1, Value::Integer);
                 requireType("sub/value-2", v2, Value::Integer);
                 v2.value -= v1.value;
-                stack[stack.size() - 1] = v2;
-                break;
-            }
-            case Opcode::Mult: {
-                Value v1 = stack.back(); stack.pop_back();
-                Value v2 = stack.back();
-                v1 = readLocal(v1, locals);
-                v2 = readLocal(v2, locals);
+                PUSH(v2);
+                NEXT_OPCODE;
+            }
+            CASE(Mult) {
+                Value v1 = POP();
+                Value v2 = POP();
+                v1 = READ_LOCAL(v1);
+                v2 = READ_LOCAL(v2);
                 requireType("mult/value-1", v1, Value::Integer);
                 requireType("mult/value-2", v2, Value::Integer);
                 v2.value *= v1.value;
-                stack[stack.size() - 1] = v2;
-                break;
-            }
-            case Opcode::Div: {
-                Value v1 = stack.back(); stack.pop_back();
-                Value v2 = stack.back();
-                v1 = readLocal(v1, locals);
-                v2 = readLocal(v2, locals);
+                PUSH(v2);
+                NEXT_OPCODE;
+            }
+            CASE(Div) {
+                Value v1 = POP();
+                Value v2 = POP();
+                v1 = READ_LOCAL(v1);
+                v2 = READ_LOCAL(v2);
                 requireType("div/value-1", v1, Value::Integer);
                 requireType("div/value-2", v2, Value::Integer);
                 v2.value /= v1.value;
-                stack[stack.size() - 1] = v2;
-                break;
+                PUSH(v2);
+                NEXT_OPCODE;
             }
 
-            case Opcode::WaitKey: {
-                std::string input;
-                std::cin >> input;
-                if (!input.empty()) {
-                    stack.push_back(Value{Value::Integer, input[0]});
-                } else {
-                    stack.push_back(Value{Value::None});
-                }
-                break;
+            CASE(WaitKey) {
+                output.flush();
+                if (suspendable) SUSPEND(RunStatus::WaitingForKey);
+                std::string word;
+                input->read(word);
+                PUSH(keyValue(word));
+                NEXT_OPCODE;
             }
 
-            default: {
-                std::stringstream ss;
-                ss << "Unknown opcode " << opcode << " at code position " << ip << '.';
-                throw RuntimeError(ss.str());
+            CASE(NewList)
+                SAVE_STATE();
+                PUSH(make(Value::List));
+                NEXT_OPCODE;
+            CASE(NewMap)
+                SAVE_STATE();
+                PUSH(make(Value::Map));
+                NEXT_OPCODE;
+            CASE(NewObject)
+                SAVE_STATE();
+                PUSH(make(Value::Object));
+                NEXT_OPCODE;
+
+            // Each superinstruction starts where the first instruction of its
+            // sequence did, and reads the operands the sequence had from where
+            // they were, other than those the fusion pass moved into the
+            // first instruction's operand bytes.
+            // the 8-bit forms read their target from the Push8's one operand
+            // byte in place of the Push32's four
+#define PUSH_JUMP(name, READ_TARGET)                                    \
+            FUSED_CASE(name)                                            \
+                ip.skip(1);                                             \
+                intValue = READ_TARGET();                               \
+                ip.skip(1);                                             \
+                JUMP_TO(intValue);                                      \
+                NEXT_OPCODE;
+            PUSH_JUMP(PushJump, READ_32)
+            PUSH_JUMP(PushJump8, READ_8)
+#undef PUSH_JUMP
+#define PUSH_JUMP_IF(name, test, READ_TARGET)                           \
+            FUSED_CASE(name) {                                          \
+                ip.skip(1);                                             \
+                intValue = READ_TARGET();                               \
+                ip.skip(1);                                             \
+                Value value = READ_LOCAL(POP());                        \
+                if (value.value test) {                                 \
+                    JUMP_TO(intValue);                                  \
+                }                                                       \
+                NEXT_OPCODE;                                            \
             }
-        }
-    }
+            PUSH_JUMP_IF(PushJumpZero, == 0, READ_32)
+            PUSH_JUMP_IF(PushJumpNotZero, != 0, READ_32)
+            PUSH_JUMP_IF(PushJumpLessThan, < 0, READ_32)
+            PUSH_JUMP_IF(PushJumpLessThanEqual, <= 0, READ_32)
+            PUSH_JUMP_IF(PushJumpGreaterThan, > 0, READ_32)
+            PUSH_JUMP_IF(PushJumpGreaterThanEqual, >= 0, READ_32)
+            PUSH_JUMP_IF(PushJumpZero8, == 0, READ_8)
+            PUSH_JUMP_IF(PushJumpNotZero8, != 0, READ_8)
+            PUSH_JUMP_IF(PushJumpLessThan8, < 0, READ_8)
+            PUSH_JUMP_IF(PushJumpLessThanEqual8, <= 0, READ_8)
+            PUSH_JUMP_IF(PushJumpGreaterThan8, > 0, READ_8)
+            PUSH_JUMP_IF(PushJumpGreaterThanEqual8, >= 0, READ_8)
+#undef PUSH_JUMP_IF
+#define COMPARE_JUMP_IF(name, test, READ_TARGET)                        \
+            FUSED_CASE(name) {                                          \
+                Value v1 = READ_LOCAL(POP());                           \
+                Value v2 = READ_LOCAL(POP());                           \
+                if (v1.type != v2.type) compareTypeError(v1, v2);       \
+                int difference = v2.value - v1.value;                   \
+                ip.skip(2);                                             \
+                intValue = READ_TARGET();                               \
+                ip.skip(1);                                             \
+                if (difference test) {                                  \
+                    JUMP_TO(intValue);                                  \
+                }                                                       \
+                NEXT_OPCODE;                                            \
+            }
+            COMPARE_JUMP_IF(CompareJumpZero, == 0, READ_32)
+            COMPARE_JUMP_IF(CompareJumpNotZero, != 0, READ_32)
+            COMPARE_JUMP_IF(CompareJumpLessThan, < 0, READ_32)
+            COMPARE_JUMP_IF(CompareJumpLessThanEqual, <= 0, READ_32)
+            COMPARE_JUMP_IF(CompareJumpGreaterThan, > 0, READ_32)
+            COMPARE_JUMP_IF(CompareJumpGreaterThanEqual, >= 0, READ_32)
+            COMPARE_JUMP_IF(CompareJumpZero8, == 0, READ_8)
+            COMPARE_JUMP_IF(CompareJumpNotZero8, != 0, READ_8)
+            COMPARE_JUMP_IF(CompareJumpLessThan8, < 0, READ_8)
+            COMPARE_JUMP_IF(CompareJumpLessThanEqual8, <= 0, READ_8)
+            COMPARE_JUMP_IF(CompareJumpGreaterThan8, > 0, READ_8)
+            COMPARE_JUMP_IF(CompareJumpGreaterThanEqual8, >= 0, READ_8)
+#undef COMPARE_JUMP_IF
+            // the pushed value or local number is the operand byte
+            FUSED_CASE(AddImmediate) {
+                intValue = static_cast<int8_t>(READ_8());
+                ip.skip(1);
+                Value v2 = READ_LOCAL(POP());
+                requireType("add/value-2", v2, Value::Integer);
+                v2.value += intValue;
+                PUSH(v2);
+                NEXT_OPCODE;
+            }
+            FUSED_CASE(SubImmediate) {
+                intValue = static_cast<int8_t>(READ_8());
+                ip.skip(1);
+                Value v2 = READ_LOCAL(POP());
+                requireType("sub/value-2", v2, Value::Integer);
+                v2.value -= intValue;
+                PUSH(v2);
+                NEXT_OPCODE;
+            }
+            FUSED_CASE(AddLocal) {
+                Value v1 = locals[READ_8()];
+                ip.skip(1);
+                Value v2 = READ_LOCAL(POP());
+                requireType("add/value-1", v1, Value::Integer);
+                requireType("add/value-2", v2, Value::Integer);
+                v2.value += v1.value;
+                PUSH(v2);
+                NEXT_OPCODE;
+            }
+            FUSED_CASE(SubLocal) {
+                Value v1 = locals[READ_8()];
+                ip.skip(1);
+                Value v2 = READ_LOCAL(POP());
+                requireType("sub/value-1", v1, Value::Integer);
+                requireType("sub/value-2", v2, Value::Integer);
+                v2.value -= v1.value;
+                PUSH(v2);
+                NEXT_OPCODE;
+            }
+            FUSED_CASE(StoreLocal)
+                intValue = READ_8();
+                ip.skip(1);
+                locals[intValue] = POP();
+                NEXT_OPCODE;
 
-    return Value{};
-}
\ No newline at end of file
+            DEFAULT_CASE
+                unknownOpcode(opcode, ip.position());
+    DISPATCH_END
+
+    return false;
+}
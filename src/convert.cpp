@@ -0,0 +1,54 @@
+/* **************************************************************************
+ * Gamefile Converter
+ *
+ * Rewrites a gamefile in another format version, by default the latest,
+ * optionally packing its strings.
+ *
+ * Part of GTRPE by Gren Drake
+ * **************************************************************************/
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "gamedata.h"
+#include "gamefile.h"
+
+static void usage(const char *name) {
+    std::cerr << "USAGE: " << name << " [--version=N] [--pack-strings] infile outfile\n";
+    std::cerr << "  --version=N         format version to write (default "
+              << GameFile::latestVersion << ")\n";
+    std::cerr << "  --pack-strings      Huffman code the text of strings, which is then\n";
+    std::cerr << "                      decoded only as it is printed\n";
+}
+
+int main(int argc, char *argv[]) {
+    unsigned version = GameFile::latestVersion;
+    bool packStrings = false;
+    std::string files[2];
+    unsigned fileCount = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 10, "--version=") == 0 && arg.size() > 10) {
+            version = std::strtoul(arg.c_str() + 10, nullptr, 10);
+        } else if (arg == "--pack-strings") {
+            packStrings = true;
+        } else if (arg[0] != '-' && fileCount < 2) {
+            files[fileCount++] = arg;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (fileCount != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    GameData data;
+    data.load(files[0]);
+    if (!data.gameLoaded) {
+        std::cerr << "Failed to load game data.\n";
+        return 1;
+    }
+    return writeGameFile(data, files[1], version, packStrings) ? 0 : 1;
+}
@@ -0,0 +1,302 @@
+/* **************************************************************************
+ * Differential Testing
+ *
+ * Checks the fast ways of running a game (unchecked interpreter, fused code,
+ * JIT) against the checked interpreter, which is simple enough to trust, by
+ * running both a step at a time and comparing everything a game can see.
+ *
+ * Part of GTRPE by Gren Drake
+ * **************************************************************************/
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include "differential.h"
+#include "runner.h"
+#include "runtime_error.h"
+
+namespace {
+
+    // calls and backward jumps each engine makes between comparisons
+    const int64_t stepBudget = 1;
+
+    // an input source for a runner that is only ever resumed, so WaitKey
+    // always suspends rather than reading
+    class NoInput : public InputSource {
+    public:
+        void read(std::string &word) override {
+            word.clear();
+        }
+    };
+
+    struct Engine {
+        explicit Engine(const char *name)
+        : name(name), output(new MemorySink), failed(false)
+        { }
+
+        const char *name;
+        Runner runner;
+        MemorySink *output;     // owned by the runner's Output
+        bool failed;
+        std::string error;
+    };
+
+    // do something to an engine's runner, noting any runtime error and
+    // passing on what it printed
+    template<class Action>
+    void advance(Engine &engine, Action action) {
+        try {
+            action(engine.runner);
+        } catch (RuntimeError &e) {
+            engine.failed = true;
+            engine.error = e.what();
+        }
+        engine.runner.getOutput().flush();
+    }
+
+    std::string where(const Runner &runner) {
+        const std::vector<Frame> &frames = runner.getFrames();
+        if (frames.empty()) return "no function running";
+        const Frame &frame = frames.back();
+        std::stringstream ss;
+        ss << "function " << frame.function->ident << " at offset "
+           << frame.ip - frame.function->position << ", depth " << frames.size();
+        return ss.str();
+    }
+
+    // a little of what was printed, from offset on, on one line
+    std::string excerpt(const std::string &text, size_t offset) {
+        std::string result = "\"";
+        for (size_t i = offset; i < text.size() && i < offset + 24; ++i) {
+            if (text[i] == '\n') {
+                result += "\\n";
+            } else {
+                result += text[i];
+            }
+        }
+        return result + '"';
+    }
+
+    // the first way in which the state of the two engines differs, or an
+    // empty string if they match; printed is how much they printed before
+    std::string difference(const Engine &a, const Engine &b, uint64_t printed) {
+        std::stringstream ss;
+        if (a.failed || b.failed) {
+            if (a.failed && b.failed && a.error == b.error) return "";
+            for (const Engine *engine : { &a, &b }) {
+                ss << "\n    " << engine->name << ": "
+                   << (engine->failed ? "runtime error: " + engine->error : "no runtime error");
+            }
+            return "runtime errors differ" + ss.str();
+        }
+
+        const std::string &textA = a.output->text(), &textB = b.output->text();
+        if (textA != textB) {
+            size_t at = std::mismatch(textA.begin(), textA.end(), textB.begin(), textB.end()).first
+                      - textA.begin();
+            ss << "output differs from byte " << printed + at << "\n    "
+               << a.name << ": " << excerpt(textA, at) << "\n    "
+               << b.name << ": " << excerpt(textB, at);
+            return ss.str();
+        }
+
+        if (a.runner.getStatus() != b.runner.getStatus()) {
+            for (const Engine *engine : { &a, &b }) {
+                static const char *const names[] = {
+                    "finished", "ready", "waiting for a key", "out of budget"
+                };
+                ss << "\n    " << engine->name << ": "
+                   << names[static_cast<int>(engine->runner.getStatus())];
+            }
+            return "status differs" + ss.str();
+        }
+
+        const std::vector<Frame> &framesA = a.runner.getFrames(), &framesB = b.runner.getFrames();
+        if (framesA.size() != framesB.size()) {
+            ss << "call depth differs: " << framesA.size() << " vs " << framesB.size();
+            return ss.str();
+        }
+        for (unsigned i = framesA.size(); i-- > 0; ) {
+            const Frame &frameA = framesA[i], &frameB = framesB[i];
+            if (frameA.function->ident != frameB.function->ident
+                    || frameA.ip - frameA.function->position != frameB.ip - frameB.function->position
+                    || frameA.base != frameB.base) {
+                ss << "frame " << i << " differs";
+                return ss.str();
+            }
+        }
+
+        std::vector<Value> stackA = a.runner.getStack(), stackB = b.runner.getStack();
+        if (stackA.size() != stackB.size()) {
+            ss << "stack size differs: " << stackA.size() << " vs " << stackB.size();
+            return ss.str();
+        }
+        for (unsigned i = 0; i < stackA.size(); ++i) {
+            if (stackA[i].type != stackB[i].type || stackA[i].value != stackB[i].value) {
+                ss << "stack slot " << i << " differs: " << stackA[i] << " vs " << stackB[i];
+                return ss.str();
+            }
+        }
+
+        const Value &resultA = a.runner.getResult(), &resultB = b.runner.getResult();
+        if (resultA.type != resultB.type || resultA.value != resultB.value) {
+            ss << "return value differs: " << resultA << " vs " << resultB;
+            return ss.str();
+        }
+
+        // all that is left of the state is the heap
+        ByteStream stateA, stateB;
+        a.runner.writeState(stateA);
+        b.runner.writeState(stateB);
+        if (stateA.size() != stateB.size()
+                || std::memcmp(stateA.bytes(), stateB.bytes(), stateA.size()) != 0) {
+            return "contents of lists, maps or objects differ";
+        }
+        return "";
+    }
+
+    bool sameState(const Runner &runner, const ByteStream &state) {
+        ByteStream now;
+        runner.writeState(now);
+        return now.size() == state.size()
+            && std::memcmp(now.bytes(), state.bytes(), state.size()) == 0;
+    }
+
+    // the first thing wrong with saving, loading or undoing the state of an
+    // engine stopped at WaitKey, or an empty string if nothing is; the
+    // engine is left as it was, but with its garbage collected
+    std::string snapshotProblem(std::shared_ptr<const GameData> data, Engine &engine,
+                                const std::string &word, int64_t turnLimit) {
+        // a collection already under way finishes without freeing what was
+        // made while it ran, so run a full one after it
+        engine.runner.collectGarbage();
+        engine.runner.collectGarbage();
+        ByteStream state;
+        engine.runner.writeState(state);
+        unsigned made = engine.runner.madeCount();
+
+        ByteStream saved;
+        engine.runner.writeSave(saved);
+        Runner loaded;
+        loaded.attach(data);
+        std::stringstream refusal;
+        std::streambuf *errors = std::cerr.rdbuf(refusal.rdbuf());
+        bool loadedSave = loaded.readSave(saved.bytes(), saved.size(), "the save");
+        // the fingerprint follows the save's id, version and bytecode size
+        std::vector<uint8_t> altered(saved.bytes(), saved.bytes() + saved.size());
+        altered[12] ^= 1;
+        bool loadedAltered = loaded.readSave(altered.data(), altered.size(), "the altered save");
+        std::cerr.rdbuf(errors);
+        if (!loadedSave) return "a save would not load: " + refusal.str();
+        if (!sameState(loaded, state)) return "a save loaded with a different state";
+        if (loadedAltered) return "a save with a different fingerprint was loaded";
+        if (refusal.str().find("different gamefile") == std::string::npos) {
+            return "a save with a different fingerprint was refused for the wrong reason: "
+                 + refusal.str();
+        }
+
+        engine.runner.checkpoint();
+        advance(engine, [&word, turnLimit](Runner &runner) {
+            runner.giveKey(word);
+            runner.resume(turnLimit > 0 ? turnLimit : Runner::unlimited);
+        });
+        engine.output->clear();
+        engine.failed = false;
+        engine.error.clear();
+        if (!engine.runner.restoreCheckpoint()) return "the checkpoint before a turn was lost";
+        engine.runner.collectGarbage();
+        engine.runner.collectGarbage();
+        if (engine.runner.madeCount() != made) {
+            std::stringstream ss;
+            ss << "after a turn was undone " << engine.runner.madeCount()
+               << " lists, maps and objects were left in use rather than " << made;
+            return ss.str();
+        }
+        if (!sameState(engine.runner, state)) return "undoing a turn did not put the state back";
+        return "";
+    }
+
+}
+
+bool runDifferential(std::shared_ptr<const GameData> data, const DifferentialOptions &options,
+                     InputSource &input, std::ostream &out, std::ostream &report) {
+    Engine reference("reference"), fast("fast");
+    reference.runner.useReferenceInterpreter();
+    if (!options.fusion) fast.runner.disableFusion();
+    for (Engine *engine : { &reference, &fast }) {
+        engine->runner.attach(data);
+        engine->runner.setInput(std::unique_ptr<InputSource>(new NoInput));
+        engine->runner.getOutput().setSink(std::unique_ptr<OutputSink>(engine->output));
+    }
+    if (options.useJit) fast.runner.enableJit(options.jitThreshold);
+
+    uint64_t steps = 0, printed = 0;
+    int64_t turnSteps = 0;
+    std::string agreed = "the start of main";
+    for (Engine *engine : { &reference, &fast }) {
+        advance(*engine, [](Runner &runner) { runner.startMain(); });
+    }
+    while (1) {
+        std::string different = difference(reference, fast, printed);
+        if (!different.empty()) {
+            out.flush();
+            report << "ENGINES DIVERGED at step " << steps << ": " << different << '\n'
+                   << "  last agreed at " << agreed << '\n'
+                   << "  reference now at " << where(reference.runner) << '\n'
+                   << "  fast now at " << where(fast.runner) << '\n';
+            return false;
+        }
+        const std::string &text = reference.output->text();
+        out.write(text.data(), text.size());
+        printed += text.size();
+        reference.output->clear();
+        fast.output->clear();
+
+        if (reference.failed) {
+            out.flush();
+            report << "Engines agreed over " << steps << " steps, until both stopped with: "
+                   << reference.error << '\n';
+            return true;
+        }
+        RunStatus status = reference.runner.getStatus();
+        if (status == RunStatus::Finished) {
+            out.flush();
+            report << "Engines agreed over " << steps << " steps; main returned "
+                   << reference.runner.getResult() << '\n';
+            return true;
+        }
+        if (options.turnLimit > 0 && turnSteps >= options.turnLimit) {
+            out.flush();
+            report << "Engines agreed over " << steps << " steps, until a turn passed the limit.\n";
+            return true;
+        }
+
+        agreed = where(reference.runner);
+        if (status == RunStatus::WaitingForKey) {
+            out.flush();
+            std::string word;
+            input.read(word);
+            if (options.snapshots) {
+                for (Engine *engine : { &reference, &fast }) {
+                    std::string problem = snapshotProblem(data, *engine, word, options.turnLimit);
+                    if (problem.empty()) continue;
+                    report << "SNAPSHOT FAILED at step " << steps << " on the " << engine->name
+                           << " engine: " << problem << '\n'
+                           << "  at " << agreed << '\n';
+                    return false;
+                }
+            }
+            for (Engine *engine : { &reference, &fast }) {
+                advance(*engine, [&word](Runner &runner) { runner.giveKey(word); });
+            }
+            turnSteps = 0;
+        } else {
+            for (Engine *engine : { &reference, &fast }) {
+                advance(*engine, [](Runner &runner) { runner.resume(stepBudget); });
+            }
+            ++steps;
+            ++turnSteps;
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef DIFFERENTIAL_H
+#define DIFFERENTIAL_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+
+#include "gamedata.h"
+
+class InputSource;
+
+struct DifferentialOptions {
+    // whether the engine under test compiles hot functions, and fuses
+    // common sequences into superinstructions
+    bool useJit = false;
+    unsigned jitThreshold = 0;
+    bool fusion = true;
+    // calls and backward jumps one turn may make before the run is stopped,
+    // or 0 for no limit
+    int64_t turnLimit = 0;
+    // whether to check saving, loading and undo at every WaitKey
+    bool snapshots = false;
+};
+
+// Runs a game twice in lockstep over the same input: once with every
+// function on the checked reference interpreter, and once the way the
+// runner normally would, with verified functions run unchecked on the fused
+// code and compiled if the JIT is on. Both are resumed one call or backward
+// jump at a time, and after each the output, status, frames, stack, return
+// value and the contents of every changed or made list, map and object must
+// match. The reference's output is written to out as it goes.
+//
+// With snapshots on, both engines also collect garbage at every WaitKey, and
+// each is then saved and the save loaded into a fresh runner, which must
+// have the same state; the save must be refused once its fingerprint is
+// changed; and each takes the turn, then undoes it and collects again, which
+// must leave its state as it was, with everything the turn made freed.
+//
+// If the two ever differ, what differs is written to report along with the
+// function and position each engine has reached, and the position both had
+// reached when they last agreed; the first differing instruction lies
+// between the two. Otherwise a summary is written once main returns, a
+// runtime error stops both, or a turn goes past the limit. Returns whether
+// the engines agreed throughout.
+bool runDifferential(std::shared_ptr<const GameData> data, const DifferentialOptions &options,
+                     InputSource &input, std::ostream &out, std::ostream &report);
+
+#endif
@@ -0,0 +1,84 @@
+/* **************************************************************************
+ * Superinstruction Fusion
+ *
+ * Rewrites common instruction sequences in verified functions into the
+ * internal superinstructions listed at the end of opcode.h. These were chosen
+ * from opcode pair counts, where the same few pairs lead: a Push8 or Push32
+ * of a jump target directly before the jump that uses it, a Compare before
+ * such a push and a conditional jump, and a Push0, Push1 or PushNeg1 of a small
+ * integer or a local before an Add, Sub or Store. A superinstruction keeps
+ * the length of the first instruction it replaces, reusing its operand bytes
+ * for anything it needs, and the interpreter skips the rest of the sequence.
+ *
+ * Part of GTRPE by Gren Drake
+ * **************************************************************************/
+#include "fusion.h"
+#include "gamedata.h"
+#include "opcode.h"
+#include "verifier.h"
+
+namespace {
+
+    bool isConditionalJump(int opcode) {
+        return opcode >= Opcode::JumpZero && opcode <= Opcode::JumpGreaterThanEqual;
+    }
+
+    int shortPushValue(int opcode) {
+        return opcode == Opcode::Push0 ? 0 : opcode == Opcode::Push1 ? 1 : -1;
+    }
+
+}
+
+void fuseFunction(GameData &data, const FunctionDef &function, const CodeMap &map,
+                  int localCount) {
+    const ByteStream &code = data.bytecode;
+    ByteStream &fused = data.fusedCode;
+
+    // an instruction that passed the verifier lies wholly within the function,
+    // as does every instruction it falls through to
+    for (unsigned offset = 0; offset < map.at.size(); ++offset) {
+        if (map.at[offset] == CodeMap::NotInstruction) continue;
+        const unsigned at = function.position + offset;
+        const int opcode = code.read_8(at);
+
+        if ((opcode == Opcode::Push32 || opcode == Opcode::Push8)
+                && code.read_8(at + 1) == Value::JumpTarget) {
+            const bool wide = opcode == Opcode::Push32;
+            int jump = code.read_8(at + (wide ? 6 : 3));
+            if (jump == Opcode::Jump || isConditionalJump(jump)) {
+                int first = wide ? Opcode::PushJump : Opcode::PushJump8;
+                fused.overwrite_8(at, first + (jump - Opcode::Jump));
+            }
+        } else if (opcode == Opcode::Compare && code.read_8(at + 2) == Value::JumpTarget
+                   && (code.read_8(at + 1) == Opcode::Push32
+                       || code.read_8(at + 1) == Opcode::Push8)) {
+            const bool wide = code.read_8(at + 1) == Opcode::Push32;
+            int jump = code.read_8(at + (wide ? 7 : 4));
+            if (isConditionalJump(jump)) {
+                int first = wide ? Opcode::CompareJumpZero : Opcode::CompareJumpZero8;
+                fused.overwrite_8(at, first + (jump - Opcode::JumpZero));
+            }
+        } else if (opcode == Opcode::Push0 || opcode == Opcode::Push1
+                   || opcode == Opcode::PushNeg1) {
+            const int type = code.read_8(at + 1);
+            const int value = shortPushValue(opcode);
+            const int next = code.read_8(at + 2);
+            const bool isLocal = type == Value::LocalVar && value >= 0 && value < localCount;
+            int superinstruction = -1;
+            if (next == Opcode::Add || next == Opcode::Sub) {
+                bool add = next == Opcode::Add;
+                if (type == Value::Integer) {
+                    superinstruction = add ? Opcode::AddImmediate : Opcode::SubImmediate;
+                } else if (isLocal) {
+                    superinstruction = add ? Opcode::AddLocal : Opcode::SubLocal;
+                }
+            } else if (next == Opcode::Store && isLocal) {
+                superinstruction = Opcode::StoreLocal;
+            }
+            if (superinstruction >= 0) {
+                fused.overwrite_8(at, superinstruction);
+                fused.overwrite_8(at + 1, static_cast<uint8_t>(value));
+            }
+        }
+    }
+}
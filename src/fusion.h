@@ -0,0 +1,19 @@
+#ifndef FUSION_H
+#define FUSION_H
+
+struct CodeMap;
+struct FunctionDef;
+struct GameData;
+
+// Puts superinstructions in GameData::fusedCode in place of the sequences of
+// instructions a function that passed the verifier runs most often, going by
+// opcode pair counts from the profiler. Only the first instruction of each
+// sequence is rewritten, and the rest are left as they were, so jumps into
+// the middle of a sequence and positions saved within one still find the
+// instructions they expect. The fused code is shared by every function whose
+// code starts where this one's does, so a local is only fused in when it is
+// below localCount, the fewest arguments and locals of any of them.
+void fuseFunction(GameData &data, const FunctionDef &function, const CodeMap &map,
+                  int localCount);
+
+#endif
@@ -1,118 +1,388 @@
-#include <fstream>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <sstream>
+#include <thread>
 
 #include "gamedata.h"
+#include "gamefile.h"
+#include "parallel.h"
 #include "runtime_error.h"
+#include "verifier.h"
 
-static uint32_t read_32(std::istream &in);
-static uint16_t read_16(std::istream &in);
-static uint8_t read_8(std::istream &in);
-static std::string read_str(std::istream &in);
+namespace {
 
+    // gamefiles at least this large have their tables read, and their
+    // functions verified, on several threads at once
+    const size_t parallelLoadSize = 1 << 20;
+    const unsigned maxLoadThreads = 4;
+
+    // run every loader, on several threads if given them, and return whether
+    // all of them succeeded
+    bool runLoaders(const std::vector<std::function<bool()>> &loaders, unsigned threads) {
+        std::vector<char> succeeded(loaders.size());
+        parallelFor(loaders.size(), threads, [&loaders, &succeeded](unsigned i) {
+            succeeded[i] = loaders[i]();
+        });
+        return std::find(succeeded.begin(), succeeded.end(), false) == succeeded.end();
+    }
+
+}
 
 void GameData::load(const std::string filename) {
-    std::ifstream inf(filename);
-    if (!inf) {
+    if (!file.open(filename)) {
         std::cerr << "Could not open ~" << filename << "~.\n";
         return;
     }
-    if(read_32(inf) != FILETYPE_ID) {
+    unsigned threads = 1;
+    if (file.size() >= parallelLoadSize) {
+        threads = std::max(1u, std::min(std::thread::hardware_concurrency(), maxLoadThreads));
+    }
+    ByteCursor inf(file.data(), file.size());
+    if(inf.read_32() != FILETYPE_ID) {
         std::cerr << '~' << filename << "~ is not a valid gamefile.\n";
         return;
     }
-    int version = read_32(inf);
-    if(version != 0) {
+    unsigned version = inf.read_32();
+    bool loaded = false;
+    if (version == 0) {
+        loaded = loadVersion0(inf, threads);
+    } else if (version == 1) {
+        loaded = loadVersion1(threads);
+    } else {
         std::cerr << '~' << filename << "~ has format version " << version;
-        std::cerr << ", but only version 0 is supported.\n";
+        std::cerr << ", but only versions 0 to " << GameFile::latestVersion << " are supported.\n";
         return;
     }
-    mainFunction = read_32(inf);
-    unsigned count = 0;
-
-    // READ STRINGS
-    count = read_32(inf);
-    for (unsigned i = 0; i < count; ++i) {
-        StringDef def;
-        def.ident = i;
-        def.text = read_str(inf);
-        strings.insert(std::make_pair(def.ident, def));
-    }
-
-    // READ LISTS
-    count = read_32(inf);
-    for (unsigned i = 0; i < count; ++i) {
-        ListDef def;
-        def.ident = read_32(inf);
-        unsigned itemCount = read_16(inf);
-        for (unsigned j = 0; j < itemCount; ++j) {
-            Value value;
-            value.type = static_cast<Value::Type>(read_8(inf));
-            value.value = read_32(inf);
-            def.items.push_back(value);
+    if (!loaded) {
+        std::cerr << '~' << filename << "~ is truncated or corrupt.\n";
+        return;
+    }
+    if (!identsInRange()) {
+        std::cerr << '~' << filename << "~ has lists, maps or objects numbered from ";
+        std::cerr << firstRuntimeIdent << " up, which are kept for ones made while running.\n";
+        return;
+    }
+    verifyFunctions(*this, threads);
+    gameLoaded = true;
+}
+
+bool GameData::loadVersion0(ByteCursor &inf, unsigned threads) {
+    mainFunction = inf.read_32();
+
+    // Records in a version 0 gamefile vary in length, so a first pass skips
+    // through them to find where each table starts, and each table then gets
+    // a reader of its own, starting at its count. Each record of the string,
+    // list, map and object tables has a header ending in a 16-bit count of
+    // the items that follow it.
+    const unsigned headerSizes[] = { 2, 6, 6, 6 };
+    const unsigned itemSizes[] = { 1, 5, 10, 7 };
+    std::vector<ByteCursor> tables;
+    for (unsigned table = 0; table < 4; ++table) {
+        const uint8_t *start = inf.here();
+        unsigned count = inf.read_count(headerSizes[table]);
+        for (unsigned i = 0; i < count; ++i) {
+            inf.take(headerSizes[table] - 2);
+            inf.take(static_cast<size_t>(inf.read_16()) * itemSizes[table]);
+        }
+        if (!inf.ok()) return false;
+        tables.push_back(ByteCursor(start, inf.here() - start));
+    }
+    const uint8_t *start = inf.here();
+    inf.take(static_cast<size_t>(inf.read_count(12)) * 12);
+    if (!inf.ok()) return false;
+    tables.push_back(ByteCursor(start, inf.here() - start));
+
+    unsigned count = inf.read_32();
+    const uint8_t *code = inf.take(count);
+    if (!inf.ok()) return false;
+    bytecode.view(code, count);
+
+    std::vector<std::function<bool()>> loaders = {
+        [this, &tables]() {
+            ByteCursor &in = tables[0];
+            unsigned count = in.read_count(2);
+            strings.reserve(count);
+            for (unsigned i = 0; i < count; ++i) {
+                StringDef def;
+                def.ident = i;
+                def.text = in.read_str();
+                def.length = def.text.size();
+                strings.insert(def);
+            }
+            return in.ok();
+        },
+        [this, &tables]() {
+            ByteCursor &in = tables[1];
+            unsigned count = in.read_count(6);
+            lists.reserve(count);
+            for (unsigned i = 0; i < count; ++i) {
+                ListDef def;
+                def.ident = in.read_32();
+                unsigned itemCount = in.read_16();
+                for (unsigned j = 0; j < itemCount; ++j) {
+                    def.items.push_back(in.read_value());
+                }
+                lists.insert(def);
+            }
+            return in.ok();
+        },
+        [this, &tables]() {
+            ByteCursor &in = tables[2];
+            unsigned count = in.read_count(6);
+            maps.reserve(count);
+            for (unsigned i = 0; i < count; ++i) {
+                MapDef def;
+                def.ident = in.read_32();
+                unsigned itemCount = in.read_16();
+                for (unsigned j = 0; j < itemCount; ++j) {
+                    Value key = in.read_value();
+                    Value value = in.read_value();
+                    def.rows.set(key, value);
+                }
+                maps.insert(def);
+            }
+            return in.ok();
+        },
+        [this, &tables]() {
+            ByteCursor &in = tables[3];
+            unsigned count = in.read_count(6);
+            objects.reserve(count);
+            for (unsigned i = 0; i < count; ++i) {
+                ObjectDef def;
+                def.ident = in.read_32();
+                unsigned itemCount = in.read_16();
+                std::map<unsigned, Value> properties;
+                for (unsigned j = 0; j < itemCount; ++j) {
+                    unsigned propId = in.read_16();
+                    Value value = in.read_value();
+                    properties.insert(std::make_pair(propId, value));
+                }
+                std::vector<unsigned> propIds;
+                for (const auto &property : properties) {
+                    propIds.push_back(property.first);
+                    def.slots.push_back(property.second);
+                }
+                def.shape = internShape(propIds);
+                objects.insert(def);
+            }
+            return in.ok();
+        },
+        [this, &tables]() {
+            ByteCursor &in = tables[4];
+            unsigned count = in.read_count(12);
+            functions.reserve(count);
+            for (unsigned i = 0; i < count; ++i) {
+                FunctionDef def;
+                def.ident = in.read_32();
+                def.arg_count = in.read_16();
+                def.local_count = in.read_16();
+                def.position = in.read_32();
+                def.verified = false;
+                def.maxStack = 0;
+                functions.insert(def);
+            }
+            return in.ok();
+        },
+    };
+    return runLoaders(loaders, threads);
+}
+
+namespace {
+
+    // One section of a version 1 gamefile, as an array of fixed-width
+    // records.
+    struct Section {
+        const uint8_t *start = nullptr;
+        uint32_t size = 0;
+
+        unsigned count(unsigned recordSize) const {
+            return size / recordSize;
         }
-        lists.insert(std::make_pair(def.ident, def));
-    }
-
-    count = read_32(inf);
-    for (unsigned i = 0; i < count; ++i) {
-        MapDef def;
-        def.ident = read_32(inf);
-        unsigned itemCount = read_16(inf);
-        for (unsigned j = 0; j < itemCount; ++j) {
-            Value v1, v2;
-            v1.type = static_cast<Value::Type>(read_8(inf));
-            v1.value = read_32(inf);
-            v2.type = static_cast<Value::Type>(read_8(inf));
-            v2.value = read_32(inf);
-            def.rows.push_back(MapDef::Row{v1,v2});
+        bool holds(uint32_t first, uint32_t count, unsigned recordSize) const {
+            return first <= size / recordSize && count <= size / recordSize - first;
         }
-        maps.insert(std::make_pair(def.ident, def));
-    }
-
-    count = read_32(inf);
-    for (unsigned i = 0; i < count; ++i) {
-        ObjectDef def;
-        def.ident = read_32(inf);
-        unsigned itemCount = read_16(inf);
-        for (unsigned j = 0; j < itemCount; ++j) {
-            unsigned propId = read_16(inf);
-            Value value;
-            value.type = static_cast<Value::Type>(read_8(inf));
-            value.value = read_32(inf);
-            def.properties.insert(std::make_pair(propId, value));
+        ByteCursor records(uint32_t first, uint32_t count, unsigned recordSize) const {
+            return ByteCursor(start + static_cast<size_t>(first) * recordSize,
+                          static_cast<size_t>(count) * recordSize);
+        }
+    };
+
+}
+
+bool GameData::loadVersion1(unsigned threads) {
+    ByteCursor header(file.data(), file.size());
+    header.take(8);
+    mainFunction = header.read_32();
+    unsigned sectionCount = header.read_count(GameFile::tocEntrySize);
+    Section sections[GameFile::SectionLimit];
+    for (unsigned i = 0; i < sectionCount; ++i) {
+        uint32_t kind = header.read_32();
+        uint32_t offset = header.read_32();
+        uint32_t size = header.read_32();
+        if (offset % GameFile::sectionAlignment != 0 || offset > file.size()
+                || size > file.size() - offset) {
+            return false;
+        }
+        if (kind < GameFile::SectionLimit) {
+            sections[kind].start = file.data() + offset;
+            sections[kind].size = size;
         }
-        objects.insert(std::make_pair(def.ident, def));
     }
+    if (!header.ok()) return false;
 
-    count = read_32(inf);
-    for (unsigned i = 0; i < count; ++i) {
-        FunctionDef def;
-        def.ident = read_32(inf);
-        def.arg_count = read_16(inf);
-        def.local_count = read_16(inf);
-        def.position = read_32(inf);
-        functions.insert(std::make_pair(def.ident, def));
+    const Section &codeLengths = sections[GameFile::TextCode];
+    packedStrings = codeLengths.size > 0;
+    if (packedStrings) {
+        if (codeLengths.size != HuffmanCode::symbolCount) return false;
+        if (!textCode.setLengths(codeLengths.start)) return false;
     }
+    const Section &code = sections[GameFile::Bytecode];
+    bytecode.view(code.start, code.size);
 
-    count = read_32(inf);
-    for (unsigned i = 0; i < count; ++i) {
-        bytecode.add_8(read_8(inf));
+    // the table of contents says where every table is, so each can be
+    // decoded by its own loader
+    std::vector<std::function<bool()>> loaders = {
+        [this, &sections]() {
+            // packed strings are only decoded when they are printed, so all
+            // that can be checked here is that each starts within the packed
+            // text
+            const Section &stringIndex = sections[GameFile::Strings];
+            const Section &stringText = packedStrings ? sections[GameFile::PackedText]
+                                                      : sections[GameFile::StringText];
+            unsigned count = stringIndex.count(GameFile::stringSize);
+            strings.reserve(count);
+            ByteCursor records = stringIndex.records(0, count, GameFile::stringSize);
+            for (unsigned i = 0; i < count; ++i) {
+                StringDef def;
+                def.ident = i;
+                uint32_t offset = records.read_32();
+                def.length = records.read_32();
+                uint32_t size = def.length;
+                if (packedStrings) {
+                    if (offset > stringText.size || (def.length > 0 && offset == stringText.size)) {
+                        return false;
+                    }
+                    size = stringText.size - offset;
+                } else if (!stringText.holds(offset, def.length, 1)) {
+                    return false;
+                }
+                def.text = std::string_view(reinterpret_cast<const char*>(stringText.start + offset), size);
+                strings.insert(def);
+            }
+            return true;
+        },
+        [this, &sections]() {
+            const Section &listItems = sections[GameFile::ListItems];
+            unsigned count = sections[GameFile::Lists].count(GameFile::rangeSize);
+            lists.reserve(count);
+            ByteCursor records = sections[GameFile::Lists].records(0, count, GameFile::rangeSize);
+            for (unsigned i = 0; i < count; ++i) {
+                ListDef def;
+                def.ident = records.read_32();
+                uint32_t first = records.read_32();
+                uint32_t itemCount = records.read_32();
+                if (!listItems.holds(first, itemCount, GameFile::valueSize)) return false;
+                ByteCursor items = listItems.records(first, itemCount, GameFile::valueSize);
+                def.items.reserve(itemCount);
+                for (unsigned j = 0; j < itemCount; ++j) {
+                    def.items.push_back(items.read_aligned_value());
+                }
+                lists.insert(def);
+            }
+            return true;
+        },
+        [this, &sections]() {
+            const Section &mapRows = sections[GameFile::MapRows];
+            unsigned count = sections[GameFile::Maps].count(GameFile::rangeSize);
+            maps.reserve(count);
+            ByteCursor records = sections[GameFile::Maps].records(0, count, GameFile::rangeSize);
+            for (unsigned i = 0; i < count; ++i) {
+                MapDef def;
+                def.ident = records.read_32();
+                uint32_t first = records.read_32();
+                uint32_t rowCount = records.read_32();
+                if (!mapRows.holds(first, rowCount, GameFile::mapRowSize)) return false;
+                ByteCursor rows = mapRows.records(first, rowCount, GameFile::mapRowSize);
+                for (unsigned j = 0; j < rowCount; ++j) {
+                    Value key = rows.read_aligned_value();
+                    Value value = rows.read_aligned_value();
+                    def.rows.set(key, value);
+                }
+                maps.insert(def);
+            }
+            return true;
+        },
+        [this, &sections]() {
+            const Section &properties = sections[GameFile::Properties];
+            unsigned count = sections[GameFile::Objects].count(GameFile::rangeSize);
+            objects.reserve(count);
+            ByteCursor records = sections[GameFile::Objects].records(0, count, GameFile::rangeSize);
+            for (unsigned i = 0; i < count; ++i) {
+                ObjectDef def;
+                def.ident = records.read_32();
+                uint32_t first = records.read_32();
+                uint32_t propertyCount = records.read_32();
+                if (!properties.holds(first, propertyCount, GameFile::propertySize)) return false;
+                ByteCursor props = properties.records(first, propertyCount, GameFile::propertySize);
+                std::vector<unsigned> propIds;
+                for (unsigned j = 0; j < propertyCount; ++j) {
+                    unsigned propId = props.read_32();
+                    if (!propIds.empty() && propId <= propIds.back()) return false;
+                    propIds.push_back(propId);
+                    def.slots.push_back(props.read_aligned_value());
+                }
+                def.shape = internShape(propIds);
+                objects.insert(def);
+            }
+            return true;
+        },
+        [this, &sections]() {
+            unsigned count = sections[GameFile::Functions].count(GameFile::functionSize);
+            functions.reserve(count);
+            ByteCursor records = sections[GameFile::Functions].records(0, count, GameFile::functionSize);
+            for (unsigned i = 0; i < count; ++i) {
+                FunctionDef def;
+                def.ident = records.read_32();
+                def.arg_count = records.read_16();
+                def.local_count = records.read_16();
+                def.position = records.read_32();
+                def.verified = false;
+                def.maxStack = 0;
+                functions.insert(def);
+            }
+            return true;
+        },
+    };
+    return runLoaders(loaders, threads);
+}
+
+bool GameData::identsInRange() const {
+    for (const ListDef &list : lists) {
+        if (list.ident >= firstRuntimeIdent) return false;
     }
-    gameLoaded = true;
+    for (const MapDef &map : maps) {
+        if (map.ident >= firstRuntimeIdent) return false;
+    }
+    for (const ObjectDef &object : objects) {
+        if (object.ident >= firstRuntimeIdent) return false;
+    }
+    return true;
 }
 
 void GameData::dump() const {
     std::cout << "\n## Strings\n";
+    std::string buffer;
     for (const auto &stringDef : strings) {
-        std::cout << '[' << stringDef.second.ident << "] ~";
-        std::cout << stringDef.second.text << "~\n";
+        std::cout << '[' << stringDef.ident << "] ~";
+        std::cout << stringText(stringDef, buffer) << "~\n";
     }
 
     std::cout << "\n## Lists\n";
     for (const auto &listDef : lists) {
-        std::cout << '[' << listDef.second.ident << "] {";
-        for (const Value &value : listDef.second.items) {
+        std::cout << '[' << listDef.ident << "] {";
+        for (const Value &value : listDef.items) {
             std::cout << ' ' << value;
         }
         std::cout << " }\n";
@@ -120,28 +390,28 @@ void GameData::dump() const {
 
     std::cout << "\n## Maps\n";
     for (const auto &mapDef : maps) {
-        std::cout << '[' << mapDef.second.ident << "] {";
-        for (const MapDef::Row &row : mapDef.second.rows) {
-            std::cout << " (" << row.key << ", " << row.value << ")";
+        std::cout << '[' << mapDef.ident << "] {";
+        for (const ValueMap::Slot &slot : mapDef.rows.slotList()) {
+            if (slot.used) std::cout << " (" << slot.key << ", " << slot.value << ")";
         }
         std::cout << " }\n";
     }
 
     std::cout << "\n## Objects\n";
     for (const auto &objectDef : objects) {
-        std::cout << '[' << objectDef.second.ident << "] {";
-        for (const auto &property : objectDef.second.properties) {
-            std::cout << " (" << property.first << ", " << property.second << ")";
+        std::cout << '[' << objectDef.ident << "] {";
+        for (unsigned i = 0; i < objectDef.slots.size(); ++i) {
+            std::cout << " (" << objectDef.shape->properties[i] << ", " << objectDef.slots[i] << ")";
         }
         std::cout << " }\n";
     }
 
     std::cout << "\n## Function Headers\n";
     for (const auto &functionDef : functions) {
-        std::cout << '[' << functionDef.second.ident << "] args: ";
-        std::cout << functionDef.second.arg_count << " locals: ";
-        std::cout << functionDef.second.local_count << " position: ";
-        std::cout << functionDef.second.position << "\n";
+        std::cout << '[' << functionDef.ident << "] args: ";
+        std::cout << functionDef.arg_count << " locals: ";
+        std::cout << functionDef.local_count << " position: ";
+        std::cout << functionDef.position << "\n";
     }
 
     std::cout << "\n## Bytecode";
@@ -149,61 +419,68 @@ void GameData::dump() const {
 }
 
 const FunctionDef& GameData::getFunction(int ident) const {
-    auto functionIter = functions.find(ident);
-    if (functionIter == functions.end()) {
+    const FunctionDef *functionDef = functions.find(ident);
+    if (!functionDef) {
         std::stringstream ss;
         ss << "Tried to access non-existant function " << ident << '.';
         throw RuntimeError(ss.str());
     }
-    return functionIter->second;
+    return *functionDef;
 }
 
 const ObjectDef& GameData::getObject(int ident) const {
-    auto objectIter = objects.find(ident);
-    if (objectIter == objects.end()) {
+    const ObjectDef *objectDef = objects.find(ident);
+    if (!objectDef) {
         std::stringstream ss;
         ss << "Tried to access non-existant object " << ident << '.';
         throw RuntimeError(ss.str());
     }
-    return objectIter->second;
+    return *objectDef;
 }
 
 const StringDef& GameData::getString(int ident) const {
-    auto stringIter = strings.find(ident);
-    if (stringIter == strings.end()) {
+    const StringDef *stringDef = strings.find(ident);
+    if (!stringDef) {
         std::stringstream ss;
         ss << "Tried to access non-existant string " << ident << '.';
         throw RuntimeError(ss.str());
     }
-    return stringIter->second;
+    return *stringDef;
 }
 
-
-
-
-uint32_t read_32(std::istream &in) {
-    uint32_t value;
-    in.read(reinterpret_cast<char*>(&value), sizeof(value));
-    return value;
+std::string_view GameData::stringText(const StringDef &string, std::string &buffer) const {
+    if (!packedStrings) return string.text;
+    const uint8_t *bits = reinterpret_cast<const uint8_t*>(string.text.data());
+    if (!textCode.decode(bits, string.text.size(), string.length, buffer)) {
+        std::stringstream ss;
+        ss << "String " << string.ident << " is corrupt.";
+        throw RuntimeError(ss.str());
+    }
+    return buffer;
 }
 
-uint16_t read_16(std::istream &in) {
-    uint16_t value;
-    in.read(reinterpret_cast<char*>(&value), sizeof(value));
-    return value;
+const Shape* GameData::internShape(const std::vector<unsigned> &properties) {
+    auto shapeIter = shapesByProperties.find(properties);
+    if (shapeIter != shapesByProperties.end()) {
+        return shapeIter->second;
+    }
+    shapes.push_back(Shape{properties});
+    const Shape *shape = &shapes.back();
+    shapesByProperties.insert(std::make_pair(properties, shape));
+    return shape;
 }
 
-uint8_t read_8(std::istream &in) {
-    uint8_t value;
-    in.read(reinterpret_cast<char*>(&value), sizeof(value));
-    return value;
+const Shape* GameData::findShape(const std::vector<unsigned> &properties) const {
+    auto shapeIter = shapesByProperties.find(properties);
+    return shapeIter == shapesByProperties.end() ? nullptr : shapeIter->second;
 }
 
-std::string read_str(std::istream &in) {
-    int length = read_16(in);
-    std::string text(length, ' ');
-    for (int i = 0; i < length; ++i) {
-        text[i] = read_8(in);
+const std::string& GameData::getSymbol(int ident) const {
+    if (ident < 0 || ident >= static_cast<int>(symbols.size())) {
+        std::stringstream ss;
+        ss << "Tried to access non-existant symbol " << ident << '.';
+        throw RuntimeError(ss.str());
     }
-    return text;
+    return symbols[ident];
 }
+
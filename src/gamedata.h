@@ -1,55 +1,97 @@
 #ifndef GAMEDATA_H
 #define GAMEDATA_H
 
+#include <deque>
 #include <map>
+#include <string>
+#include <string_view>
+#include <vector>
 #include "bytestream.h"
+#include "huffman.h"
+#include "identtable.h"
+#include "mappedfile.h"
+#include "shape.h"
 #include "value.h"
+#include "valuemap.h"
 
 const int FILETYPE_ID = 0x47505254;
+// lists, maps and objects made while a game runs are numbered from here up,
+// so gamefiles can't use these numbers
+const int firstRuntimeIdent = 0x40000000;
 
 struct StringDef {
     int ident;
-    std::string text;
+    unsigned length;
+    // points into the mapped gamefile; when strings are packed, this is the
+    // coded form of length bytes of text, running on to the end of its section
+    std::string_view text;
 };
 struct ListDef {
     int ident;
     std::vector<Value> items;
 };
 struct MapDef {
-    struct Row {
-        Value key, value;
-    };
     int ident;
-    std::vector<Row> rows;
+    ValueMap rows;
 };
 struct ObjectDef {
     int ident;
-    std::map<unsigned, Value> properties;
+    const Shape *shape;
+    std::vector<Value> slots;
 };
 struct FunctionDef {
     int ident;
     int arg_count;
     int local_count;
     unsigned position;
+
+    // set by verifyFunctions for functions that can run unchecked
+    bool verified;
+    unsigned maxStack;
 };
 
+// Everything loaded from a gamefile. Once loaded it is never changed, so one
+// GameData can be shared by any number of Runners, even on different threads.
 struct GameData {
-    GameData() : gameLoaded(false) { }
+    GameData() : gameLoaded(false), packedStrings(false) { }
+    GameData(const GameData&) = delete;
+    GameData& operator=(const GameData&) = delete;
     void load(const std::string filename);
     void dump() const;
 
     const FunctionDef& getFunction(int ident) const;
     const ObjectDef& getObject(int ident) const;
     const StringDef& getString(int ident) const;
+    // the text of a string, decoded into buffer if it is packed
+    std::string_view stringText(const StringDef &string, std::string &buffer) const;
+    const std::string& getSymbol(int ident) const;
+    const Shape* internShape(const std::vector<unsigned> &properties);
+    const Shape* findShape(const std::vector<unsigned> &properties) const;
 
     bool gameLoaded;
     int mainFunction;
-    std::map<int, StringDef> strings;
-    std::map<int, ListDef> lists;
-    std::map<int, MapDef> maps;
-    std::map<int, ObjectDef> objects;
-    std::map<int, FunctionDef> functions;
+    IdentTable<StringDef> strings;
+    IdentTable<ListDef> lists;
+    IdentTable<MapDef> maps;
+    IdentTable<ObjectDef> objects;
+    IdentTable<FunctionDef> functions;
+    std::vector<std::string> symbols;
+    std::deque<Shape> shapes;
+    std::map<std::vector<unsigned>, const Shape*> shapesByProperties;
     ByteStream bytecode;
+    // the bytecode with superinstructions in place of common sequences in
+    // verified functions, for the interpreter to run them with
+    ByteStream fusedCode;
+    // whether the text of strings is Huffman coded, and the code used
+    bool packedStrings;
+    HuffmanCode textCode;
+    MappedFile file;
+private:
+    // each decodes the tables of one version of gamefile, on up to threads
+    // threads at once
+    bool loadVersion0(ByteCursor &inf, unsigned threads);
+    bool loadVersion1(unsigned threads);
+    bool identsInRange() const;
 };
 
 #endif
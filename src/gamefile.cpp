@@ -0,0 +1,246 @@
+/* **************************************************************************
+ * Gamefile Writer
+ *
+ * Writes loaded game data back out as a gamefile of either format version,
+ * for converting between them. The layout of each is described in
+ * gamefile.h.
+ *
+ * Part of GTRPE by Gren Drake
+ * **************************************************************************/
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+
+#include "gamedata.h"
+#include "gamefile.h"
+
+namespace {
+
+    void writeValue(ByteStream &out, const Value &value) {
+        out.add_8(value.type);
+        out.add_32(value.value);
+    }
+
+    void writeAlignedValue(ByteStream &out, const Value &value) {
+        out.add_32(value.type);
+        out.add_32(value.value);
+    }
+
+    bool fits16(unsigned value, const char *what, int ident) {
+        if (value <= 0xFFFF) return true;
+        std::cerr << what << ' ' << ident << " is too large for a version 0 gamefile.\n";
+        return false;
+    }
+
+    bool stringsInOrder(const GameData &data) {
+        int expected = 0;
+        for (const StringDef &string : data.strings) {
+            if (string.ident != expected++) {
+                std::cerr << "Strings must be numbered in order from 0.\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool buildVersion0(const GameData &data, ByteStream &out) {
+        out.add_32(FILETYPE_ID);
+        out.add_32(0);
+        out.add_32(data.mainFunction);
+
+        out.add_32(data.strings.size());
+        std::string buffer;
+        for (const StringDef &string : data.strings) {
+            std::string_view text = data.stringText(string, buffer);
+            if (!fits16(text.size(), "String", string.ident)) return false;
+            out.add_16(text.size());
+            out.append(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+        }
+
+        out.add_32(data.lists.size());
+        for (const ListDef &list : data.lists) {
+            if (!fits16(list.items.size(), "List", list.ident)) return false;
+            out.add_32(list.ident);
+            out.add_16(list.items.size());
+            for (const Value &item : list.items) writeValue(out, item);
+        }
+
+        out.add_32(data.maps.size());
+        for (const MapDef &map : data.maps) {
+            if (!fits16(map.rows.size(), "Map", map.ident)) return false;
+            out.add_32(map.ident);
+            out.add_16(map.rows.size());
+            for (const ValueMap::Slot &slot : map.rows.slotList()) {
+                if (!slot.used) continue;
+                writeValue(out, slot.key);
+                writeValue(out, slot.value);
+            }
+        }
+
+        out.add_32(data.objects.size());
+        for (const ObjectDef &object : data.objects) {
+            if (!fits16(object.slots.size(), "Object", object.ident)) return false;
+            out.add_32(object.ident);
+            out.add_16(object.slots.size());
+            for (unsigned i = 0; i < object.slots.size(); ++i) {
+                if (!fits16(object.shape->properties[i], "Property of object", object.ident)) {
+                    return false;
+                }
+                out.add_16(object.shape->properties[i]);
+                writeValue(out, object.slots[i]);
+            }
+        }
+
+        out.add_32(data.functions.size());
+        for (const FunctionDef &function : data.functions) {
+            out.add_32(function.ident);
+            out.add_16(function.arg_count);
+            out.add_16(function.local_count);
+            out.add_32(function.position);
+        }
+
+        out.add_32(data.bytecode.size());
+        out.append(data.bytecode);
+        return true;
+    }
+
+    // write the text of every string once, however many strings have it
+    void buildStrings(const GameData &data, bool pack, ByteStream sections[]) {
+        std::string buffer;
+        HuffmanCode code;
+        if (pack) {
+            std::vector<uint64_t> frequencies(HuffmanCode::symbolCount);
+            for (const StringDef &string : data.strings) {
+                for (char c : data.stringText(string, buffer)) {
+                    ++frequencies[static_cast<uint8_t>(c)];
+                }
+            }
+            code.build(frequencies);
+            for (unsigned i = 0; i < HuffmanCode::symbolCount; ++i) {
+                sections[GameFile::TextCode].add_8(code.lengths()[i]);
+            }
+        }
+
+        ByteStream &text = sections[pack ? GameFile::PackedText : GameFile::StringText];
+        std::unordered_map<std::string, unsigned> offsets;
+        for (const StringDef &string : data.strings) {
+            std::string_view content = data.stringText(string, buffer);
+            auto existing = offsets.emplace(std::string(content), text.size());
+            if (existing.second) {
+                if (pack) {
+                    code.encode(content, text);
+                } else {
+                    text.append(reinterpret_cast<const uint8_t*>(content.data()), content.size());
+                }
+                // an empty string takes no bytes, so give it one of its own
+                // rather than the offset of the string written after it
+                if (content.empty()) text.add_8(0);
+            }
+            sections[GameFile::Strings].add_32(existing.first->second);
+            sections[GameFile::Strings].add_32(content.size());
+        }
+    }
+
+    bool buildVersion1(const GameData &data, bool packStrings, ByteStream &out) {
+        ByteStream sections[GameFile::SectionLimit];
+        sections[GameFile::Strings].reserve(data.strings.size() * GameFile::stringSize);
+        sections[GameFile::Lists].reserve(data.lists.size() * GameFile::rangeSize);
+        sections[GameFile::Maps].reserve(data.maps.size() * GameFile::rangeSize);
+        sections[GameFile::Objects].reserve(data.objects.size() * GameFile::rangeSize);
+        sections[GameFile::Functions].reserve(data.functions.size() * GameFile::functionSize);
+        buildStrings(data, packStrings, sections);
+
+        unsigned first = 0;
+        for (const ListDef &list : data.lists) {
+            sections[GameFile::Lists].add_32(list.ident);
+            sections[GameFile::Lists].add_32(first);
+            sections[GameFile::Lists].add_32(list.items.size());
+            for (const Value &item : list.items) {
+                writeAlignedValue(sections[GameFile::ListItems], item);
+            }
+            first += list.items.size();
+        }
+
+        first = 0;
+        for (const MapDef &map : data.maps) {
+            sections[GameFile::Maps].add_32(map.ident);
+            sections[GameFile::Maps].add_32(first);
+            sections[GameFile::Maps].add_32(map.rows.size());
+            for (const ValueMap::Slot &slot : map.rows.slotList()) {
+                if (!slot.used) continue;
+                writeAlignedValue(sections[GameFile::MapRows], slot.key);
+                writeAlignedValue(sections[GameFile::MapRows], slot.value);
+            }
+            first += map.rows.size();
+        }
+
+        first = 0;
+        for (const ObjectDef &object : data.objects) {
+            sections[GameFile::Objects].add_32(object.ident);
+            sections[GameFile::Objects].add_32(first);
+            sections[GameFile::Objects].add_32(object.slots.size());
+            for (unsigned i = 0; i < object.slots.size(); ++i) {
+                sections[GameFile::Properties].add_32(object.shape->properties[i]);
+                writeAlignedValue(sections[GameFile::Properties], object.slots[i]);
+            }
+            first += object.slots.size();
+        }
+
+        for (const FunctionDef &function : data.functions) {
+            sections[GameFile::Functions].add_32(function.ident);
+            sections[GameFile::Functions].add_16(function.arg_count);
+            sections[GameFile::Functions].add_16(function.local_count);
+            sections[GameFile::Functions].add_32(function.position);
+        }
+
+        sections[GameFile::Bytecode].append(data.bytecode);
+
+        const unsigned sectionCount = GameFile::SectionLimit - 1;
+        out.add_32(FILETYPE_ID);
+        out.add_32(1);
+        out.add_32(data.mainFunction);
+        out.add_32(sectionCount);
+        unsigned offset = GameFile::headerSize + sectionCount * GameFile::tocEntrySize;
+        for (unsigned kind = 1; kind < GameFile::SectionLimit; ++kind) {
+            offset = (offset + GameFile::sectionAlignment - 1)
+                   / GameFile::sectionAlignment * GameFile::sectionAlignment;
+            out.add_32(kind);
+            out.add_32(offset);
+            out.add_32(sections[kind].size());
+            offset += sections[kind].size();
+        }
+        out.reserve(offset);
+        for (unsigned kind = 1; kind < GameFile::SectionLimit; ++kind) {
+            out.padTo(GameFile::sectionAlignment);
+            out.append(sections[kind]);
+        }
+        return true;
+    }
+
+}
+
+bool writeGameFile(const GameData &data, const std::string &filename, unsigned version,
+                   bool packStrings) {
+    ByteStream out;
+    if (!stringsInOrder(data)) return false;
+    if (version == 0) {
+        if (packStrings) {
+            std::cerr << "Version 0 gamefiles cannot hold packed strings.\n";
+            return false;
+        }
+        if (!buildVersion0(data, out)) return false;
+    } else if (version == 1) {
+        if (!buildVersion1(data, packStrings, out)) return false;
+    } else {
+        std::cerr << "Cannot write gamefiles of version " << version << ".\n";
+        return false;
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "Could not write to ~" << filename << "~.\n";
+        return false;
+    }
+    out.write(file);
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,69 @@
+#ifndef GAMEFILE_H
+#define GAMEFILE_H
+
+#include <cstdint>
+#include <string>
+
+struct GameData;
+
+// Layout of version 1 gamefiles. A fixed header and table of contents come
+// first, giving where each section is:
+//
+//   u32 FILETYPE_ID, u32 version (1), u32 main function, u32 section count
+//   section count * { u32 kind, u32 offset, u32 size }
+//
+// Every section starts at a multiple of 8 bytes into the file and is an
+// array of fixed-width little-endian records, so any record can be found
+// without reading those before it:
+//
+//   Strings         { u32 offset, u32 length } into StringText, by ident
+//   StringText      the text of every string
+//   Lists           { u32 ident, u32 first, u32 count } into ListItems
+//   ListItems       value
+//   Maps            { u32 ident, u32 first, u32 count } into MapRows
+//   MapRows         { value key, value value }
+//   Objects         { u32 ident, u32 first, u32 count } into Properties
+//   Properties      { u32 property, value value }, in order of property
+//   Functions       { u32 ident, u16 argument count, u16 local count,
+//                     u32 position within Bytecode }
+//   Bytecode        the code of every function
+//   TextCode        the length of each byte's code, for packed strings
+//   PackedText      the text of every string, Huffman coded
+//
+// where a value is { u32 type, i32 value }, the same as a Value in memory.
+// A gamefile with a TextCode section has packed strings: each string's
+// offset is into PackedText instead of StringText, where its text is coded
+// as described in huffman.h. Strings with the same text may share it.
+// Sections of kinds not listed here are ignored, and missing ones are empty.
+//
+// Version 0 gamefiles instead hold the same data as one stream of
+// variable-length records, read in order.
+namespace GameFile {
+
+    enum Section {
+        Strings = 1, StringText, Lists, ListItems, Maps, MapRows,
+        Objects, Properties, Functions, Bytecode, TextCode, PackedText,
+        SectionLimit
+    };
+
+    const unsigned headerSize = 16;
+    const unsigned tocEntrySize = 12;
+    const unsigned sectionAlignment = 8;
+
+    const unsigned stringSize = 8;
+    const unsigned rangeSize = 12;
+    const unsigned valueSize = 8;
+    const unsigned mapRowSize = 16;
+    const unsigned propertySize = 12;
+    const unsigned functionSize = 12;
+
+    const unsigned latestVersion = 1;
+
+}
+
+// write data as a gamefile of the given version, with its strings packed if
+// requested, reporting anything that version cannot hold to std::cerr
+bool writeGameFile(const GameData &data, const std::string &filename,
+                   unsigned version = GameFile::latestVersion, bool packStrings = false);
+
+#endif
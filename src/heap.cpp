@@ -0,0 +1,437 @@
+#include <algorithm>
+#include <climits>
+#include <sstream>
+
+#include "gamedata.h"
+#include "heap.h"
+#include "runtime_error.h"
+
+namespace {
+    [[noreturn]] void missing(const char *kind, int ident) {
+        std::stringstream ss;
+        ss << "Tried to access non-existant " << kind << ' ' << ident << '.';
+        throw RuntimeError(ss.str());
+    }
+
+    template<class F>
+    void forEachValue(const ListDef &list, F f) {
+        for (const Value &item : list.items) f(item);
+    }
+    template<class F>
+    void forEachValue(const MapDef &map, F f) {
+        for (const ValueMap::Slot &slot : map.rows.slotList()) {
+            if (!slot.used) continue;
+            f(slot.key);
+            f(slot.value);
+        }
+    }
+    template<class F>
+    void forEachValue(const ObjectDef &object, F f) {
+        for (const Value &slot : object.slots) f(slot);
+    }
+}
+
+template<class T>
+void Heap::Containers<T>::clear() {
+    copies = IdentTable<T>();
+    copyEpochs.clear();
+    copyScans.clear();
+    made.clear();
+    madeFlags.clear();
+    madeEpochs.clear();
+    freeSlots.clear();
+}
+
+void Heap::load(const GameData &data) {
+    this->data = &data;
+    lists.clear();
+    maps.clear();
+    objects.clear();
+    // so copies of the game's own lists, maps and objects are found through
+    // the dense index, as the originals are
+    lists.copies.reserve(data.lists.size());
+    maps.copies.reserve(data.maps.size());
+    objects.copies.reserve(data.objects.size());
+    undoLog.clear();
+    shapes.clear();
+    shapesByProperties.clear();
+    transitions.clear();
+    phase = Idle;
+    gray.clear();
+    madeSinceCollection = 0;
+    collectionInterval = minimumCollectionInterval;
+}
+
+template<class T>
+const T* Heap::find(const Containers<T> &kind, const IdentTable<T> &originals, int ident) const {
+    int slot = kind.slotOf(ident);
+    if (slot >= 0) return &kind.made[slot];
+    const T *found = kind.copies.find(ident);
+    return found ? found : originals.find(ident);
+}
+
+// a list, map or object that is about to be changed, copied from the game data
+// if need be, and saved to the undo log and marked by a collection in progress
+// if it hasn't been since they last looked
+template<class T>
+T& Heap::writable(Containers<T> &kind, const IdentTable<T> &originals,
+                  std::vector<T> UndoRecord::*undone, const char *name, int ident) {
+    auto mark = [this](const Value &value) { markRoot(value); };
+    T *container;
+    unsigned *saved;
+    int slot = kind.slotOf(ident);
+    if (slot >= 0) {
+        container = &kind.made[slot];
+        saved = &kind.madeEpochs[slot];
+        if (phase == Marking && !(kind.madeFlags[slot] & Scanned)) {
+            kind.madeFlags[slot] |= Marked | Scanned;
+            forEachValue(*container, mark);
+        }
+    } else {
+        container = kind.copies.find(ident);
+        if (!container) {
+            const T *original = originals.find(ident);
+            if (!original) missing(name, ident);
+            kind.copies.insert(*original);
+            kind.copyEpochs.push_back(0);
+            // nothing in the game data can refer to anything made
+            kind.copyScans.push_back(cycle);
+            container = kind.copies.find(ident);
+        }
+        unsigned index = kind.copies.indexOf(container);
+        saved = &kind.copyEpochs[index];
+        if (phase == Marking && kind.copyScans[index] != cycle) {
+            kind.copyScans[index] = cycle;
+            forEachValue(*container, mark);
+        }
+    }
+    if (!undoLog.empty() && *saved != epoch) {
+        (undoLog.back().*undone).push_back(*container);
+        *saved = epoch;
+    }
+    return *container;
+}
+
+const std::vector<Value>& Heap::getList(int ident) const {
+    const ListDef *list = find(lists, data->lists, ident);
+    if (!list) missing("list", ident);
+    return list->items;
+}
+
+std::vector<Value>& Heap::writableList(int ident) {
+    return writable(lists, data->lists, &UndoRecord::lists, "list", ident).items;
+}
+
+const ValueMap& Heap::getMap(int ident) const {
+    const MapDef *map = find(maps, data->maps, ident);
+    if (!map) missing("map", ident);
+    return map->rows;
+}
+
+ValueMap& Heap::writableMap(int ident) {
+    return writable(maps, data->maps, &UndoRecord::maps, "map", ident).rows;
+}
+
+const ObjectDef& Heap::getObject(int ident) const {
+    const ObjectDef *object = find(objects, data->objects, ident);
+    if (!object) missing("object", ident);
+    return *object;
+}
+
+ObjectDef& Heap::writableObject(int ident) {
+    return writable(objects, data->objects, &UndoRecord::objects, "object", ident);
+}
+
+void Heap::setProperty(int objectId, unsigned propId, const Value &value) {
+    ObjectDef &object = writableObject(objectId);
+    int slot = object.shape->slotOf(propId);
+    if (slot != Shape::noSlot) {
+        object.slots[slot] = value;
+        return;
+    }
+
+    const Shape *shape = shapeWith(object.shape, propId);
+    std::vector<Value> slots;
+    slots.reserve(shape->properties.size());
+    for (unsigned i = 0, j = 0; i < shape->properties.size(); ++i) {
+        if (shape->properties[i] == propId) slots.push_back(value);
+        else                                 slots.push_back(object.slots[j++]);
+    }
+    object.shape = shape;
+    object.slots.swap(slots);
+}
+
+const Shape* Heap::shapeWith(const Shape *shape, unsigned propId) {
+    auto key = std::make_pair(shape, propId);
+    auto transition = transitions.find(key);
+    if (transition != transitions.end()) return transition->second;
+
+    std::vector<unsigned> properties = shape->properties;
+    properties.insert(std::lower_bound(properties.begin(), properties.end(), propId), propId);
+    const Shape *result = shapeFor(properties);
+    transitions.insert(std::make_pair(key, result));
+    return result;
+}
+
+// the shape for a sorted list of properties, from the game data if any
+// object there has it
+const Shape* Heap::shapeFor(const std::vector<unsigned> &properties) {
+    const Shape *shape = data->findShape(properties);
+    if (shape) return shape;
+    auto existing = shapesByProperties.find(properties);
+    if (existing != shapesByProperties.end()) return existing->second;
+    shapes.push_back(Shape{properties});
+    shape = &shapes.back();
+    shapesByProperties.insert(std::make_pair(properties, shape));
+    return shape;
+}
+
+Value Heap::make(Value::Type type) {
+    switch(type) {
+        case Value::List:
+            return Value{type, allocate(lists, ListDef(), "list")};
+        case Value::Map:
+            return Value{type, allocate(maps, MapDef(), "map")};
+        case Value::Object: {
+            ObjectDef object = ObjectDef();
+            object.shape = shapeFor(std::vector<unsigned>());
+            return Value{type, allocate(objects, object, "object")};
+        }
+        default: {
+            std::stringstream ss;
+            ss << "Cannot make a value of type " << type << '.';
+            throw RuntimeError(ss.str());
+        }
+    }
+}
+
+template<class T>
+int Heap::allocate(Containers<T> &kind, const T &empty, const char *name) {
+    unsigned slot;
+    if (kind.freeSlots.empty()) {
+        slot = kind.made.size();
+        if (slot > static_cast<unsigned>(INT_MAX - firstRuntimeIdent)) {
+            std::stringstream ss;
+            ss << "Too many of kind " << name << " made.";
+            throw RuntimeError(ss.str());
+        }
+        kind.made.push_back(empty);
+        kind.madeFlags.push_back(0);
+        kind.madeEpochs.push_back(0);
+    } else {
+        slot = kind.freeSlots.back();
+        kind.freeSlots.pop_back();
+        kind.made[slot] = empty;
+    }
+    int ident = firstRuntimeIdent + slot;
+    kind.made[slot].ident = ident;
+    // a collection in progress keeps everything made while it runs; and
+    // nothing made since the latest checkpoint needs saving for undo
+    kind.madeFlags[slot] = phase == Idle ? InUse : InUse | Marked | Scanned;
+    kind.madeEpochs[slot] = epoch;
+    ++madeSinceCollection;
+    return ident;
+}
+
+unsigned Heap::madeCount() const {
+    return lists.made.size() - lists.freeSlots.size()
+         + maps.made.size() - maps.freeSlots.size()
+         + objects.made.size() - objects.freeSlots.size();
+}
+
+void Heap::startCollection() {
+    ++cycle;
+    phase = Marking;
+    gray.clear();
+    for (uint8_t &flags : lists.madeFlags) flags &= InUse;
+    for (uint8_t &flags : maps.madeFlags) flags &= InUse;
+    for (uint8_t &flags : objects.madeFlags) flags &= InUse;
+    std::fill(std::begin(copyCursor), std::end(copyCursor), 0);
+    undoCursor = 0;
+}
+
+void Heap::markRoot(const Value &value) {
+    switch(value.type) {
+        case Value::List:   markMade(lists, Value::List, value.value);      break;
+        case Value::Map:    markMade(maps, Value::Map, value.value);        break;
+        case Value::Object: markMade(objects, Value::Object, value.value);  break;
+        default:            break;
+    }
+}
+
+template<class T>
+void Heap::markMade(Containers<T> &kind, Value::Type type, int ident) {
+    int slot = kind.slotOf(ident);
+    if (slot < 0 || kind.madeFlags[slot] & Marked) return;
+    kind.madeFlags[slot] |= Marked;
+    gray.push_back(Value{type, ident});
+}
+
+// mark everything a made container refers to, returning the work done
+template<class T>
+unsigned Heap::scanMade(Containers<T> &kind, int ident) {
+    int slot = kind.slotOf(ident);
+    if (slot < 0 || kind.madeFlags[slot] & Scanned) return 1;
+    kind.madeFlags[slot] |= Scanned;
+    unsigned work = 1;
+    forEachValue(kind.made[slot], [&](const Value &value) {
+        markRoot(value);
+        ++work;
+    });
+    return work;
+}
+
+template<class T>
+unsigned Heap::scanCopy(Containers<T> &kind, unsigned &index) {
+    const T &copy = *(kind.copies.begin() + index);
+    if (kind.copyScans[index++] == cycle) return 1;
+    kind.copyScans[index - 1] = cycle;
+    unsigned work = 1;
+    forEachValue(copy, [&](const Value &value) {
+        markRoot(value);
+        ++work;
+    });
+    return work;
+}
+
+// returns the work left over once there is no more marking to do
+unsigned Heap::markStep(unsigned work) {
+    auto mark = [this, &work](const Value &value) {
+        markRoot(value);
+        if (work > 0) --work;
+    };
+    while (work > 0) {
+        unsigned done;
+        if (!gray.empty()) {
+            Value next = gray.back();
+            gray.pop_back();
+            switch(next.type) {
+                case Value::List:   done = scanMade(lists, next.value);     break;
+                case Value::Map:    done = scanMade(maps, next.value);      break;
+                default:            done = scanMade(objects, next.value);   break;
+            }
+        } else if (copyCursor[0] < lists.copies.size()) {
+            done = scanCopy(lists, copyCursor[0]);
+        } else if (copyCursor[1] < maps.copies.size()) {
+            done = scanCopy(maps, copyCursor[1]);
+        } else if (copyCursor[2] < objects.copies.size()) {
+            done = scanCopy(objects, copyCursor[2]);
+        } else if (undoCursor < undoLog.size()) {
+            // what the undo log holds may be put back, along with the
+            // lists, maps and objects it is to be put back into
+            const UndoRecord &record = undoLog[undoCursor++];
+            for (const ListDef &list : record.lists) {
+                markRoot(Value{Value::List, list.ident});
+                forEachValue(list, mark);
+            }
+            for (const MapDef &map : record.maps) {
+                markRoot(Value{Value::Map, map.ident});
+                forEachValue(map, mark);
+            }
+            for (const ObjectDef &object : record.objects) {
+                markRoot(Value{Value::Object, object.ident});
+                forEachValue(object, mark);
+            }
+            done = 1;
+        } else {
+            phase = Sweeping;
+            std::fill(std::begin(sweepCursor), std::end(sweepCursor), 0);
+            return work;
+        }
+        work -= std::min(done, work);
+    }
+    return work;
+}
+
+// free what wasn't marked, returning the work left over
+template<class T>
+unsigned Heap::sweep(Containers<T> &kind, unsigned &slot, unsigned work) {
+    for (; slot < kind.made.size() && work > 0; ++slot, --work) {
+        if (kind.madeFlags[slot] == InUse) {
+            kind.made[slot] = T();
+            kind.madeFlags[slot] = 0;
+            kind.freeSlots.push_back(slot);
+        }
+    }
+    return work;
+}
+
+// drop the free slots at the end of the made containers, so what a turn made
+// and then lost, as when the turn is undone, leaves nothing behind
+template<class T>
+void Heap::trimMade(Containers<T> &kind) {
+    unsigned size = kind.made.size();
+    while (size > 0 && !kind.madeFlags[size - 1]) --size;
+    if (size == kind.made.size()) return;
+    kind.made.resize(size);
+    kind.madeFlags.resize(size);
+    kind.madeEpochs.resize(size);
+    kind.freeSlots.erase(std::remove_if(kind.freeSlots.begin(), kind.freeSlots.end(),
+                                        [size](unsigned slot) { return slot >= size; }),
+                         kind.freeSlots.end());
+}
+
+void Heap::collect(unsigned work) {
+    if (phase == Marking) work = markStep(work);
+    if (phase != Sweeping) return;
+    work = sweep(lists, sweepCursor[0], work);
+    work = sweep(maps, sweepCursor[1], work);
+    work = sweep(objects, sweepCursor[2], work);
+    if (sweepCursor[0] < lists.made.size() || sweepCursor[1] < maps.made.size()
+            || sweepCursor[2] < objects.made.size()) {
+        return;
+    }
+    trimMade(lists);
+    trimMade(maps);
+    trimMade(objects);
+    // wait until as much again as survived has been made before the next
+    phase = Idle;
+    madeSinceCollection = 0;
+    unsigned survivors = madeCount();
+    collectionInterval = survivors > minimumCollectionInterval ? survivors
+                                                               : minimumCollectionInterval;
+}
+
+void Heap::checkpoint() {
+    undoLog.emplace_back();
+    undoLog.back().copyCounts[0] = lists.copies.size();
+    undoLog.back().copyCounts[1] = maps.copies.size();
+    undoLog.back().copyCounts[2] = objects.copies.size();
+    ++epoch;
+}
+
+template<class T>
+void Heap::restoreAll(Containers<T> &kind, std::vector<T> &saved, unsigned copyCount) {
+    // something changed after a restore may be saved to a record a second
+    // time, so apply each record's entries newest first to leave the
+    // earliest contents in place
+    for (auto entry = saved.rbegin(); entry != saved.rend(); ++entry) {
+        int slot = kind.slotOf(entry->ident);
+        T *target = slot >= 0 ? &kind.made[slot] : kind.copies.find(entry->ident);
+        *target = std::move(*entry);
+    }
+    // copies made since the checkpoint now match the game data again
+    kind.copies.truncate(copyCount);
+    kind.copyEpochs.resize(copyCount);
+    kind.copyScans.resize(copyCount);
+}
+
+bool Heap::restore() {
+    if (undoLog.empty()) return false;
+    UndoRecord &record = undoLog.back();
+    restoreAll(lists, record.lists, record.copyCounts[0]);
+    restoreAll(maps, record.maps, record.copyCounts[1]);
+    restoreAll(objects, record.objects, record.copyCounts[2]);
+    undoLog.pop_back();
+    ++epoch;
+    // what was put back may have come from a part of the log marking hasn't
+    // reached and gone somewhere it has, so start marking again later
+    if (phase == Marking) phase = Idle;
+    return true;
+}
+
+void Heap::dropOldestCheckpoint() {
+    if (undoLog.empty()) return;
+    undoLog.pop_front();
+    if (phase == Marking && undoCursor > 0) --undoCursor;
+}
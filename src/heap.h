@@ -0,0 +1,194 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "gamedata.h"
+#include "identtable.h"
+#include "valuemap.h"
+
+// The mutable state of one running game: its lists, maps and object
+// properties. The game data loaded from the gamefile is never changed, so
+// that any number of games can share it; instead, a list, map or object is
+// copied into the heap the first time it is written, and reads look in the
+// heap before the game data.
+//
+// Lists, maps and objects can also be made while the game runs. They are
+// numbered from firstRuntimeIdent up, and reclaimed by an incremental
+// mark-and-sweep collector once nothing refers to them. A collection is
+// spread over the calls to make that follow its start, a little at a time,
+// so that no single one of them takes long.
+class Heap {
+public:
+    // how much of a collection in progress to do each time something is made,
+    // in values scanned and slots swept
+    static const unsigned workPerMake = 128;
+    // the least number of things to make between collections
+    static const unsigned minimumCollectionInterval = 1024;
+
+    Heap() : data(nullptr), epoch(1), phase(Idle), cycle(0), madeSinceCollection(0),
+             collectionInterval(minimumCollectionInterval)
+    { }
+
+    // start over with nothing yet changed from data
+    void load(const GameData &data);
+
+    const std::vector<Value>& getList(int ident) const;
+    std::vector<Value>& writableList(int ident);
+    const ValueMap& getMap(int ident) const;
+    ValueMap& writableMap(int ident);
+    const ObjectDef& getObject(int ident) const;
+    // set a property of an object, adding it if the object doesn't have it
+    void setProperty(int objectId, unsigned propId, const Value &value);
+
+    // make a new, empty list, map or object
+    Value make(Value::Type type);
+    // the number of lists, maps and objects copied so far
+    unsigned dirtyCount() const {
+        return lists.copies.size() + maps.copies.size() + objects.copies.size();
+    }
+    // the number of lists, maps and objects made and not yet freed
+    unsigned madeCount() const;
+
+    // A collection starts with startCollection, after which every value the
+    // heap can't see that might refer to something made (such as those on a
+    // runner's stack) must be passed to markRoot before anything else is done
+    // with the heap. Later values need not be, as anything that was reachable
+    // when the collection started, or has been made since, is kept.
+    bool collectionDue() const {
+        return madeSinceCollection >= collectionInterval;
+    }
+    bool collecting() const {
+        return phase != Idle;
+    }
+    void startCollection();
+    void markRoot(const Value &value);
+    // do about work units of the collection in progress
+    void collect(unsigned work);
+
+    // A checkpoint keeps the contents each list, map and object had before
+    // its first change after the checkpoint was made, so making one costs
+    // nothing up front and restoring one costs only as much as what has
+    // changed since.
+    void checkpoint();
+    // go back to how things were when the latest checkpoint was made, and
+    // discard it; returns false if there is none
+    bool restore();
+    void dropOldestCheckpoint();
+    unsigned checkpointCount() const {
+        return undoLog.size();
+    }
+
+    // write everything that differs from the game data, or replace the
+    // heap's contents with what was written from a heap over the same data
+    void write(ByteStream &out) const;
+    bool read(ByteCursor &in, unsigned version);
+private:
+    enum Phase { Idle, Marking, Sweeping };
+    enum MadeFlags : uint8_t {
+        InUse   = 1,
+        Marked  = 2,    // found to be reachable
+        Scanned = 4     // and everything it refers to has been marked too
+    };
+
+    // Lists, maps or objects of one kind.
+    template<class T>
+    struct Containers {
+        // copies of those in the game data that have been changed, with the
+        // epoch each was last saved to the undo log in, and the collection
+        // each was last scanned in
+        IdentTable<T> copies;
+        std::vector<unsigned> copyEpochs, copyScans;
+        // those made while running, by ident less firstRuntimeIdent; slots
+        // not in use are listed in freeSlots for reuse
+        std::vector<T> made;
+        std::vector<uint8_t> madeFlags;
+        std::vector<unsigned> madeEpochs;
+        std::vector<unsigned> freeSlots;
+
+        void clear();
+        // the slot of a made container that is in use, or -1
+        int slotOf(int ident) const {
+            unsigned slot = static_cast<unsigned>(ident) - firstRuntimeIdent;
+            if (ident < firstRuntimeIdent || slot >= made.size() || !madeFlags[slot]) return -1;
+            return slot;
+        }
+    };
+
+    struct UndoRecord {
+        std::vector<ListDef> lists;
+        std::vector<MapDef> maps;
+        std::vector<ObjectDef> objects;
+        // how many copies of each kind there were when the checkpoint was
+        // made; copies are only ever added, so any past these are newer
+        unsigned copyCounts[3];
+    };
+
+    template<class T>
+    const T* find(const Containers<T> &kind, const IdentTable<T> &originals, int ident) const;
+    template<class T>
+    T& writable(Containers<T> &kind, const IdentTable<T> &originals,
+                std::vector<T> UndoRecord::*undone, const char *name, int ident);
+    template<class T>
+    void restoreAll(Containers<T> &kind, std::vector<T> &saved, unsigned copyCount);
+    template<class T>
+    int allocate(Containers<T> &kind, const T &empty, const char *name);
+    template<class T>
+    void markMade(Containers<T> &kind, Value::Type type, int ident);
+    template<class T>
+    unsigned scanMade(Containers<T> &kind, int ident);
+    template<class T>
+    unsigned scanCopy(Containers<T> &kind, unsigned &index);
+    template<class T>
+    unsigned sweep(Containers<T> &kind, unsigned &slot, unsigned work);
+    template<class T>
+    void trimMade(Containers<T> &kind);
+    template<class T>
+    void writeMade(ByteStream &out, const Containers<T> &kind) const;
+    template<class T>
+    bool readMade(ByteCursor &in, Containers<T> &kind);
+    bool readContents(ByteCursor &in, ListDef &list);
+    bool readContents(ByteCursor &in, MapDef &map);
+    bool readContents(ByteCursor &in, ObjectDef &object);
+    unsigned markStep(unsigned work);
+
+    ObjectDef& writableObject(int ident);
+    const Shape* shapeWith(const Shape *shape, unsigned propId);
+    const Shape* shapeFor(const std::vector<unsigned> &properties);
+
+    const GameData *data;
+    Containers<ListDef> lists;
+    Containers<MapDef> maps;
+    Containers<ObjectDef> objects;
+    // oldest checkpoint first; the epoch changes whenever one is made or
+    // restored, and each copied or made list, map and object records the
+    // epoch it was last saved to the undo log in
+    std::deque<UndoRecord> undoLog;
+    unsigned epoch;
+    // shapes that objects get by having properties added that no object in
+    // the gamefile has, and the shape each addition leads to
+    std::deque<Shape> shapes;
+    std::map<std::vector<unsigned>, const Shape*> shapesByProperties;
+    std::map<std::pair<const Shape*, unsigned>, const Shape*> transitions;
+
+    // The collector marks from the roots it is given and from everything the
+    // heap itself holds: the copies, whose originals can refer to nothing
+    // made, and the undo log. Marking keeps a snapshot of what was reachable
+    // when it started: anything made while it runs is marked at once, and
+    // the first write to a list, map or object marks everything it held, so
+    // nothing reachable then can be hidden from it. Collections are counted
+    // by cycle, and work through their phases by the cursors.
+    Phase phase;
+    unsigned cycle;
+    std::vector<Value> gray;
+    unsigned copyCursor[3];
+    unsigned undoCursor;
+    unsigned sweepCursor[3];
+    unsigned madeSinceCollection;
+    unsigned collectionInterval;
+};
+
+#endif
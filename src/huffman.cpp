@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <utility>
+
+#include "bytestream.h"
+#include "huffman.h"
+
+HuffmanCode::HuffmanCode() {
+    std::memset(codeLengths, 0, sizeof(codeLengths));
+    assignCodes();
+}
+
+void HuffmanCode::build(const std::vector<uint64_t> &frequencies) {
+    std::vector<uint64_t> weights(frequencies);
+    weights.resize(symbolCount);
+    while (1) {
+        // each node is its weight and the node it was merged into; the
+        // first symbolCount are the leaves
+        std::vector<std::pair<uint64_t, int>> nodes;
+        typedef std::pair<uint64_t, int> Entry;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+        for (unsigned i = 0; i < symbolCount; ++i) {
+            nodes.push_back(std::make_pair(weights[i], -1));
+            if (weights[i] > 0) queue.push(std::make_pair(weights[i], i));
+        }
+        if (queue.size() == 1) {
+            nodes[queue.top().second].second = nodes.size();
+            nodes.push_back(std::make_pair(queue.top().first, -1));
+        }
+        while (queue.size() > 1) {
+            Entry first = queue.top();
+            queue.pop();
+            Entry second = queue.top();
+            queue.pop();
+            int merged = nodes.size();
+            nodes.push_back(std::make_pair(first.first + second.first, -1));
+            nodes[first.second].second = merged;
+            nodes[second.second].second = merged;
+            queue.push(std::make_pair(first.first + second.first, merged));
+        }
+
+        unsigned longest = 0;
+        for (unsigned i = 0; i < symbolCount; ++i) {
+            unsigned depth = 0;
+            for (int node = nodes[i].second; node >= 0; node = nodes[node].second) {
+                ++depth;
+            }
+            codeLengths[i] = std::min(depth, 255u);
+            longest = std::max(longest, depth);
+        }
+        if (longest <= maxLength) break;
+
+        // too deep, so even out the weights and try again; this ends at
+        // worst with every byte given the same weight
+        for (uint64_t &weight : weights) {
+            if (weight > 0) weight = weight / 2 + 1;
+        }
+    }
+    assignCodes();
+}
+
+bool HuffmanCode::setLengths(const uint8_t *lengths) {
+    // the lengths fit a prefix code if the codes they leave room for do not
+    // add up to more than a whole code space
+    uint64_t used = 0;
+    for (unsigned i = 0; i < symbolCount; ++i) {
+        if (lengths[i] > maxLength) return false;
+        if (lengths[i] > 0) used += 1u << (maxLength - lengths[i]);
+    }
+    if (used > 1u << maxLength) return false;
+    std::memcpy(codeLengths, lengths, symbolCount);
+    assignCodes();
+    return true;
+}
+
+void HuffmanCode::assignCodes() {
+    std::memset(lengthCount, 0, sizeof(lengthCount));
+    for (unsigned i = 0; i < symbolCount; ++i) {
+        ++lengthCount[codeLengths[i]];
+    }
+    lengthCount[0] = 0;
+
+    uint32_t code = 0;
+    unsigned index = 0;
+    for (unsigned length = 1; length <= maxLength; ++length) {
+        code = (code + lengthCount[length - 1]) << 1;
+        firstCode[length] = code;
+        firstSymbol[length] = index;
+        index += lengthCount[length];
+    }
+    firstCode[0] = 0;
+    firstSymbol[0] = 0;
+
+    uint16_t next[maxLength + 1];
+    std::memset(next, 0, sizeof(next));
+    for (unsigned i = 0; i < symbolCount; ++i) {
+        unsigned length = codeLengths[i];
+        if (length == 0) continue;
+        codes[i] = firstCode[length] + next[length];
+        symbols[firstSymbol[length] + next[length]] = i;
+        ++next[length];
+    }
+}
+
+void HuffmanCode::encode(std::string_view text, ByteStream &out) const {
+    uint32_t pending = 0;
+    unsigned pendingBits = 0;
+    for (char c : text) {
+        uint8_t symbol = c;
+        pending = pending << codeLengths[symbol] | codes[symbol];
+        pendingBits += codeLengths[symbol];
+        while (pendingBits >= 8) {
+            pendingBits -= 8;
+            out.add_8(pending >> pendingBits);
+        }
+    }
+    if (pendingBits > 0) {
+        out.add_8(pending << (8 - pendingBits));
+    }
+}
+
+bool HuffmanCode::decode(const uint8_t *bits, size_t size, unsigned length,
+                         std::string &out) const {
+    out.clear();
+    out.reserve(length);
+    size_t bitPos = 0;
+    const size_t bitCount = size * 8;
+    while (out.size() < length) {
+        uint32_t code = 0;
+        unsigned codeLength = 0;
+        while (1) {
+            if (bitPos >= bitCount || codeLength == maxLength) return false;
+            code = code << 1 | (bits[bitPos / 8] >> (7 - bitPos % 8) & 1);
+            ++bitPos;
+            ++codeLength;
+            uint32_t offset = code - firstCode[codeLength];
+            if (code >= firstCode[codeLength] && offset < lengthCount[codeLength]) {
+                out += static_cast<char>(symbols[firstSymbol[codeLength] + offset]);
+                break;
+            }
+        }
+    }
+    return true;
+}
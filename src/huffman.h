@@ -0,0 +1,49 @@
+#ifndef HUFFMAN_H
+#define HUFFMAN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class ByteStream;
+
+// A canonical Huffman code over bytes, used to pack string text. The code is
+// fully described by the length in bits of each byte's code (zero for bytes
+// that never occur), which is what gamefiles store. Codes are written most
+// significant bit first, and each coded text starts on a byte boundary.
+class HuffmanCode {
+public:
+    static const unsigned symbolCount = 256;
+    static const unsigned maxLength = 16;
+
+    HuffmanCode();
+
+    // build the shortest code for text with these byte frequencies
+    void build(const std::vector<uint64_t> &frequencies);
+    // use the given code lengths, returning false if they are not a prefix
+    // code or are longer than maxLength
+    bool setLengths(const uint8_t *lengths);
+    const uint8_t* lengths() const {
+        return codeLengths;
+    }
+
+    void encode(std::string_view text, ByteStream &out) const;
+    // decode length bytes of text from the size bytes at bits, returning
+    // false if it runs out of bits or meets a code that is not in use
+    bool decode(const uint8_t *bits, size_t size, unsigned length, std::string &out) const;
+private:
+    void assignCodes();
+
+    uint8_t codeLengths[symbolCount];
+    uint16_t codes[symbolCount];
+    // for each code length, the first code of that length, how many codes
+    // have it, and where their bytes start in symbols
+    uint32_t firstCode[maxLength + 1];
+    uint16_t lengthCount[maxLength + 1];
+    uint16_t firstSymbol[maxLength + 1];
+    uint8_t symbols[symbolCount];
+};
+
+#endif
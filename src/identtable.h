@@ -0,0 +1,91 @@
+#ifndef IDENTTABLE_H
+#define IDENTTABLE_H
+
+#include <unordered_map>
+#include <vector>
+
+// Table of game data definitions (anything with an "ident" member) that can
+// be looked up by ident in constant time. Definitions are stored contiguously
+// in the order they were added. Idents in the range the compiler normally uses
+// (0 up to a little past the number of definitions) are found through a
+// directly indexed array; any others fall back to a hash table.
+template<class T>
+class IdentTable {
+public:
+    typedef typename std::vector<T>::iterator iterator;
+    typedef typename std::vector<T>::const_iterator const_iterator;
+
+    // prepare for count definitions; idents below twice that are stored densely
+    void reserve(unsigned count) {
+        entries.reserve(count);
+        denseLimit = count * 2 + minimumDenseLimit;
+    }
+
+    // add a definition, unless one with the same ident already exists
+    bool insert(const T &def) {
+        if (find(def.ident)) return false;
+        int slot = entries.size();
+        entries.push_back(def);
+        if (def.ident >= 0 && static_cast<unsigned>(def.ident) < denseLimit) {
+            if (static_cast<unsigned>(def.ident) >= dense.size()) {
+                dense.resize(def.ident + 1, noSlot);
+            }
+            dense[def.ident] = slot;
+        } else {
+            sparse.insert(std::make_pair(def.ident, slot));
+        }
+        return true;
+    }
+
+    const T* find(int ident) const {
+        int slot = slotFor(ident);
+        return slot == noSlot ? nullptr : &entries[slot];
+    }
+    T* find(int ident) {
+        int slot = slotFor(ident);
+        return slot == noSlot ? nullptr : &entries[slot];
+    }
+
+    // remove the definitions added after the first count
+    void truncate(unsigned count) {
+        while (entries.size() > count) {
+            int ident = entries.back().ident;
+            if (static_cast<unsigned>(ident) < dense.size()) {
+                dense[ident] = noSlot;
+            } else {
+                sparse.erase(ident);
+            }
+            entries.pop_back();
+        }
+    }
+
+    // position of an entry of this table in insertion order
+    unsigned indexOf(const T *entry) const {
+        return entry - entries.data();
+    }
+
+    unsigned size() const           { return entries.size(); }
+    bool empty() const              { return entries.empty(); }
+    iterator begin()                { return entries.begin(); }
+    iterator end()                  { return entries.end(); }
+    const_iterator begin() const    { return entries.begin(); }
+    const_iterator end() const      { return entries.end(); }
+private:
+    enum { noSlot = -1, minimumDenseLimit = 64 };
+
+    int slotFor(int ident) const {
+        if (static_cast<unsigned>(ident) < dense.size()) {
+            return dense[ident];
+        }
+        if (sparse.empty()) return noSlot;
+        auto iter = sparse.find(ident);
+        return iter == sparse.end() ? noSlot : iter->second;
+    }
+
+    std::vector<T> entries;
+    std::vector<int> dense;
+    std::unordered_map<int, int> sparse;
+    unsigned denseLimit = minimumDenseLimit;
+};
+
+#endif
@@ -0,0 +1,8 @@
+#include <iostream>
+
+#include "input.h"
+
+void StdinSource::read(std::string &word) {
+    word.clear();
+    std::cin >> word;
+}
@@ -0,0 +1,19 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <string>
+
+// Where a game gets what the player types. Each read gives one word, which
+// is empty once no more input is coming.
+class InputSource {
+public:
+    virtual ~InputSource() { }
+    virtual void read(std::string &word) = 0;
+};
+
+class StdinSource : public InputSource {
+public:
+    void read(std::string &word) override;
+};
+
+#endif
@@ -0,0 +1,603 @@
+/* **************************************************************************
+ * Baseline JIT Compiler
+ *
+ * Translates verified functions into x86-64 machine code one instruction at a
+ * time, using the same stack layout as the interpreter so that control can
+ * pass between the two at any instruction. While compiled code runs, rbx
+ * holds the stack pointer, r12 the address of the first local and r13 the
+ * JitContext. Every instruction's code makes all of its checks before it
+ * changes anything, so when a check fails it can leave for the interpreter
+ * to run that instruction again and report the error.
+ *
+ * Only built for x86-64 Linux; elsewhere Jit::supported() returns false.
+ *
+ * Part of GTRPE by Gren Drake
+ * **************************************************************************/
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define JIT_X86_64
+#endif
+
+#include "jit.h"
+#include "opcode.h"
+#include "verifier.h"
+
+static_assert(offsetof(Value, type) == 0 && offsetof(Value, value) == 4,
+              "compiled code expects a Value's type followed by its value");
+
+struct Jit::CompiledFunction {
+    CompiledFunction() : memory(nullptr), mappedSize(0) { }
+    ~CompiledFunction();
+
+    uint8_t *memory;
+    size_t mappedSize;
+    // where the code for the instruction at each offset within the function
+    // starts, or -1 if there is none
+    std::vector<int> entries;
+};
+
+#ifdef JIT_X86_64
+
+namespace {
+
+    enum Register {
+        RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+        R8, R9, R10, R11, R12, R13, R14, R15
+    };
+    enum Condition {
+        Below = 0x2, AboveEqual = 0x3, Equal = 0x4, NotEqual = 0x5,
+        Less = 0xC, GreaterEqual = 0xD, LessEqual = 0xE, Greater = 0xF
+    };
+    enum AluOp {
+        Add = 0, Or = 1, Sub = 5, Xor = 6, Cmp = 7
+    };
+    enum ShiftOp {
+        ShiftLeft = 4, ShiftRight = 5
+    };
+
+    // Encodes the handful of x86-64 instructions the compiler uses.
+    class Assembler {
+    public:
+        unsigned size() const {
+            return code.size();
+        }
+        const std::vector<uint8_t>& bytes() const {
+            return code;
+        }
+
+        void load64(Register dst, Register base, int disp) {
+            rex(true, dst, 0, base);
+            byte(0x8B);
+            memory(dst, base, disp);
+        }
+        void load32(Register dst, Register base, int disp) {
+            rex(false, dst, 0, base);
+            byte(0x8B);
+            memory(dst, base, disp);
+        }
+        void store64(Register base, int disp, Register src) {
+            rex(true, src, 0, base);
+            byte(0x89);
+            memory(src, base, disp);
+        }
+        void store32(Register base, int disp, uint32_t imm) {
+            rex(false, 0, 0, base);
+            byte(0xC7);
+            memory(0, base, disp);
+            word(imm);
+        }
+        // dst = [base + index * 8]
+        void loadIndexed64(Register dst, Register base, Register index) {
+            rex(true, dst, index, base);
+            byte(0x8B);
+            indexed(dst, base, index);
+        }
+        // [base + index * 8] = src
+        void storeIndexed64(Register base, Register index, Register src) {
+            rex(true, src, index, base);
+            byte(0x89);
+            indexed(src, base, index);
+        }
+        void moveImm64(Register dst, uint64_t imm) {
+            rex(true, 0, 0, dst);
+            byte(0xB8 + (dst & 7));
+            for (int i = 0; i < 8; ++i) byte(imm >> (i * 8));
+        }
+        void move64(Register dst, Register src) {
+            rex(true, src, 0, dst);
+            byte(0x89);
+            direct(src, dst);
+        }
+        void alu32(AluOp op, Register dst, Register src) {
+            rex(false, src, 0, dst);
+            byte(op * 8 + 1);
+            direct(src, dst);
+        }
+        void alu64(AluOp op, Register dst, Register src) {
+            rex(true, src, 0, dst);
+            byte(op * 8 + 1);
+            direct(src, dst);
+        }
+        void aluImm32(AluOp op, Register dst, int32_t imm) {
+            rex(false, 0, 0, dst);
+            aluImm(op, dst, imm);
+        }
+        void aluImm64(AluOp op, Register dst, int32_t imm) {
+            rex(true, 0, 0, dst);
+            aluImm(op, dst, imm);
+        }
+        // [base + disp] op= imm, on 64 bits
+        void aluMemory64(AluOp op, Register base, int disp, int8_t imm) {
+            rex(true, 0, 0, base);
+            byte(0x83);
+            memory(op, base, disp);
+            byte(imm);
+        }
+        void test32(Register a, Register b) {
+            rex(false, b, 0, a);
+            byte(0x85);
+            direct(b, a);
+        }
+        void imul32(Register dst, Register src) {
+            rex(false, dst, 0, src);
+            byte(0x0F);
+            byte(0xAF);
+            direct(dst, src);
+        }
+        // edx:eax = eax sign-extended, then eax = edx:eax / divisor
+        void signedDivide32(Register divisor) {
+            byte(0x99);
+            rex(false, 0, 0, divisor);
+            byte(0xF7);
+            direct(7, divisor);
+        }
+        void shift64(ShiftOp op, Register dst, uint8_t amount) {
+            rex(true, 0, 0, dst);
+            byte(0xC1);
+            direct(op, dst);
+            byte(amount);
+        }
+        // set the low byte of dst (one of rax to rbx) if condition holds
+        void setIf(Condition condition, Register dst) {
+            byte(0x0F);
+            byte(0x90 + condition);
+            direct(0, dst);
+        }
+        void push(Register reg) {
+            rex(false, 0, 0, reg);
+            byte(0x50 + (reg & 7));
+        }
+        void pop(Register reg) {
+            rex(false, 0, 0, reg);
+            byte(0x58 + (reg & 7));
+        }
+        void jumpIndirect(Register base, int disp) {
+            rex(false, 0, 0, base);
+            byte(0xFF);
+            memory(4, base, disp);
+        }
+        void ret() {
+            byte(0xC3);
+        }
+
+        // jumps to code whose position may not be known yet; the position
+        // returned is passed to patch once it is
+        unsigned jump() {
+            byte(0xE9);
+            word(0);
+            return size();
+        }
+        unsigned jumpIf(Condition condition) {
+            byte(0x0F);
+            byte(0x80 + condition);
+            word(0);
+            return size();
+        }
+        void patch(unsigned jumpEnd, unsigned target) {
+            int32_t rel = static_cast<int32_t>(target) - static_cast<int32_t>(jumpEnd);
+            std::memcpy(&code[jumpEnd - 4], &rel, 4);
+        }
+    private:
+        void byte(uint8_t value) {
+            code.push_back(value);
+        }
+        void word(uint32_t value) {
+            for (int i = 0; i < 4; ++i) byte(value >> (i * 8));
+        }
+        void rex(bool wide, int reg, int index, int base) {
+            uint8_t prefix = 0x40 | (wide ? 8 : 0) | ((reg >> 3) << 2)
+                           | ((index >> 3) << 1) | (base >> 3);
+            if (prefix != 0x40) byte(prefix);
+        }
+        void direct(int reg, int rm) {
+            byte(0xC0 | (reg & 7) << 3 | (rm & 7));
+        }
+        void memory(int reg, int base, int disp) {
+            // always give a displacement, which keeps rbp and r13 from being
+            // taken as RIP-relative
+            bool small = disp >= -128 && disp < 128;
+            byte((small ? 0x40 : 0x80) | (reg & 7) << 3 | (base & 7));
+            if ((base & 7) == RSP) byte(0x24);
+            if (small) byte(disp);
+            else       word(disp);
+        }
+        void indexed(int reg, int base, int index) {
+            byte(0x44 | (reg & 7) << 3);
+            byte(0xC0 | (index & 7) << 3 | (base & 7));
+            byte(0);
+        }
+        void aluImm(AluOp op, Register dst, int32_t imm) {
+            if (imm >= -128 && imm < 128) {
+                byte(0x83);
+                direct(op, dst);
+                byte(imm);
+            } else {
+                byte(0x81);
+                direct(op, dst);
+                word(imm);
+            }
+        }
+
+        std::vector<uint8_t> code;
+    };
+
+    const Register stackPointer = RBX;
+    const Register localsPointer = R12;
+    const Register contextPointer = R13;
+    const int valueSize = sizeof(Value);
+
+    class FunctionCompiler {
+    public:
+        FunctionCompiler(const ByteStream &code, const FunctionDef &function, const CodeMap &map)
+        : code(code), function(function), map(map),
+          localCount(function.arg_count + function.local_count)
+        { }
+
+        void compile(std::vector<int> &entries);
+        const std::vector<uint8_t>& bytes() const {
+            return as.bytes();
+        }
+    private:
+        void compileInstruction(unsigned offset);
+        void readOperand(Register dst, int depth);
+        void requireInteger(Register reg);
+        void pushInteger(Register reg, int depth);
+        void bailIf(Condition condition);
+        void bail();
+        void jumpTo(unsigned offset);
+
+        const ByteStream &code;
+        const FunctionDef &function;
+        const CodeMap &map;
+        int localCount;
+        Assembler as;
+        unsigned current;
+        // jumps still to be pointed at an instruction, or at the code that
+        // leaves for the interpreter at an instruction
+        std::vector<std::pair<unsigned, unsigned>> jumps, bails;
+    };
+
+    void FunctionCompiler::compile(std::vector<int> &entries) {
+        // entered as void code(JitContext *context)
+        as.push(RBX);
+        as.push(R12);
+        as.push(R13);
+        as.move64(contextPointer, RDI);
+        as.load64(stackPointer, contextPointer, offsetof(JitContext, sp));
+        as.load64(localsPointer, contextPointer, offsetof(JitContext, locals));
+        as.jumpIndirect(contextPointer, offsetof(JitContext, entry));
+
+        entries.assign(map.at.size(), -1);
+        for (unsigned offset = 0; offset < map.at.size(); ++offset) {
+            if (map.at[offset] == CodeMap::NotInstruction) continue;
+            entries[offset] = as.size();
+            current = offset;
+            compileInstruction(offset);
+        }
+
+        for (const auto &jump : jumps) {
+            as.patch(jump.first, entries[jump.second]);
+        }
+
+        // leaving for the interpreter: one stub per instruction records where
+        // to continue, then all share the code that returns to the runner
+        std::map<unsigned, unsigned> stubs;
+        std::vector<unsigned> toExit;
+        for (const auto &bail : bails) {
+            auto stub = stubs.find(bail.second);
+            if (stub == stubs.end()) {
+                stub = stubs.insert(std::make_pair(bail.second, as.size())).first;
+                as.store32(contextPointer, offsetof(JitContext, ip),
+                           function.position + bail.second);
+                toExit.push_back(as.jump());
+            }
+            as.patch(bail.first, stub->second);
+        }
+        for (unsigned jump : toExit) {
+            as.patch(jump, as.size());
+        }
+        as.store64(contextPointer, offsetof(JitContext, sp), stackPointer);
+        as.pop(R13);
+        as.pop(R12);
+        as.pop(RBX);
+        as.ret();
+    }
+
+    void FunctionCompiler::bailIf(Condition condition) {
+        bails.push_back(std::make_pair(as.jumpIf(condition), current));
+    }
+
+    void FunctionCompiler::bail() {
+        bails.push_back(std::make_pair(as.jump(), current));
+    }
+
+    // jump to the instruction at offset, using up one unit of the budget if
+    // it is a backward jump; callers have already checked there is some left
+    void FunctionCompiler::jumpTo(unsigned offset) {
+        if (offset < current) {
+            as.aluMemory64(Sub, contextPointer, offsetof(JitContext, budget), 1);
+        }
+        jumps.push_back(std::make_pair(as.jump(), offset));
+    }
+
+    // load the value depth places from the top of the stack, reading through
+    // it if it refers to a local as the interpreter's readLocal does
+    void FunctionCompiler::readOperand(Register dst, int depth) {
+        as.load64(dst, stackPointer, -depth * valueSize);
+        as.aluImm32(Cmp, dst, Value::LocalVar);
+        unsigned notLocal = as.jumpIf(NotEqual);
+        as.move64(RSI, dst);
+        as.shift64(ShiftRight, RSI, 32);
+        as.aluImm32(Cmp, RSI, localCount);
+        bailIf(AboveEqual);
+        as.loadIndexed64(dst, localsPointer, RSI);
+        as.patch(notLocal, as.size());
+    }
+
+    void FunctionCompiler::requireInteger(Register reg) {
+        as.aluImm32(Cmp, reg, Value::Integer);
+        bailIf(NotEqual);
+    }
+
+    // store an integer value held in the low half of reg as the value depth
+    // places from the top of the stack, which becomes the new top
+    void FunctionCompiler::pushInteger(Register reg, int depth) {
+        as.shift64(ShiftLeft, reg, 32);
+        as.aluImm64(Or, reg, Value::Integer);
+        as.store64(stackPointer, -depth * valueSize, reg);
+        if (depth != 1) {
+            as.aluImm64(Add, stackPointer, (1 - depth) * valueSize);
+        }
+    }
+
+    void FunctionCompiler::compileInstruction(unsigned offset) {
+        unsigned ip = function.position + offset;
+        int opcode = code.read_8(ip);
+        switch(opcode) {
+            case Opcode::Push0:
+            case Opcode::Push1:
+            case Opcode::PushNeg1:
+            case Opcode::Push8:
+            case Opcode::Push16:
+            case Opcode::Push32: {
+                uint32_t type = code.read_8(ip + 1);
+                int32_t value = 0;
+                switch(opcode) {
+                    case Opcode::Push0:     value = 0;                                  break;
+                    case Opcode::Push1:     value = 1;                                  break;
+                    case Opcode::PushNeg1:  value = -1;                                 break;
+                    case Opcode::Push8:     value = static_cast<int8_t>(code.read_8(ip + 2));   break;
+                    case Opcode::Push16:    value = static_cast<int16_t>(code.read_16(ip + 2)); break;
+                    case Opcode::Push32:    value = code.read_32(ip + 2);               break;
+                }
+                as.moveImm64(RAX, static_cast<uint64_t>(static_cast<uint32_t>(value)) << 32 | type);
+                as.store64(stackPointer, 0, RAX);
+                as.aluImm64(Add, stackPointer, valueSize);
+                break;
+            }
+
+            case Opcode::Store:
+                // the verifier has proven the local to be a constant in range
+                as.load32(RAX, stackPointer, -valueSize + 4);
+                as.load64(RCX, stackPointer, -2 * valueSize);
+                as.storeIndexed64(localsPointer, RAX, RCX);
+                as.aluImm64(Sub, stackPointer, 2 * valueSize);
+                break;
+
+            case Opcode::StackPop:
+                as.aluImm64(Sub, stackPointer, valueSize);
+                break;
+            case Opcode::StackDup:
+                as.load64(RAX, stackPointer, -valueSize);
+                as.store64(stackPointer, 0, RAX);
+                as.aluImm64(Add, stackPointer, valueSize);
+                break;
+            case Opcode::StackSize:
+                as.move64(RAX, stackPointer);
+                as.alu64(Sub, RAX, localsPointer);
+                as.shift64(ShiftRight, RAX, 3);
+                as.aluImm32(Sub, RAX, localCount);
+                pushInteger(RAX, 0);
+                break;
+
+            case Opcode::Add:
+            case Opcode::Sub:
+            case Opcode::Mult:
+            case Opcode::Div:
+                readOperand(RCX, 1);
+                readOperand(RAX, 2);
+                requireInteger(RCX);
+                requireInteger(RAX);
+                as.shift64(ShiftRight, RCX, 32);
+                as.shift64(ShiftRight, RAX, 32);
+                if (opcode == Opcode::Add) {
+                    as.alu32(Add, RAX, RCX);
+                } else if (opcode == Opcode::Sub) {
+                    as.alu32(Sub, RAX, RCX);
+                } else if (opcode == Opcode::Mult) {
+                    as.imul32(RAX, RCX);
+                } else {
+                    // leave division by zero and overflow to the interpreter
+                    as.test32(RCX, RCX);
+                    bailIf(Equal);
+                    as.aluImm32(Cmp, RCX, -1);
+                    unsigned safe = as.jumpIf(NotEqual);
+                    as.aluImm32(Cmp, RAX, INT32_MIN);
+                    bailIf(Equal);
+                    as.patch(safe, as.size());
+                    as.signedDivide32(RCX);
+                }
+                pushInteger(RAX, 2);
+                break;
+
+            case Opcode::Compare:
+                readOperand(RCX, 1);
+                readOperand(RAX, 2);
+                as.alu32(Cmp, RAX, RCX);
+                bailIf(NotEqual);
+                as.shift64(ShiftRight, RCX, 32);
+                as.shift64(ShiftRight, RAX, 32);
+                as.alu32(Sub, RAX, RCX);
+                pushInteger(RAX, 2);
+                break;
+            case Opcode::CompareTypes:
+                readOperand(RCX, 1);
+                readOperand(RAX, 2);
+                as.alu32(Xor, RDX, RDX);
+                as.alu32(Cmp, RAX, RCX);
+                as.setIf(NotEqual, RDX);
+                pushInteger(RDX, 2);
+                break;
+
+            case Opcode::Jump:
+                if (static_cast<unsigned>(map.at[offset]) < offset) {
+                    // the interpreter suspends once the budget is used up
+                    as.aluMemory64(Cmp, contextPointer, offsetof(JitContext, budget), 0);
+                    bailIf(LessEqual);
+                }
+                as.aluImm64(Sub, stackPointer, valueSize);
+                jumpTo(map.at[offset]);
+                break;
+            case Opcode::JumpZero:
+            case Opcode::JumpNotZero:
+            case Opcode::JumpLessThan:
+            case Opcode::JumpLessThanEqual:
+            case Opcode::JumpGreaterThan:
+            case Opcode::JumpGreaterThanEqual: {
+                Condition condition = Equal;
+                switch(opcode) {
+                    case Opcode::JumpZero:              condition = Equal;          break;
+                    case Opcode::JumpNotZero:           condition = NotEqual;       break;
+                    case Opcode::JumpLessThan:          condition = Less;           break;
+                    case Opcode::JumpLessThanEqual:     condition = LessEqual;      break;
+                    case Opcode::JumpGreaterThan:       condition = Greater;        break;
+                    case Opcode::JumpGreaterThanEqual:  condition = GreaterEqual;   break;
+                }
+                bool backward = static_cast<unsigned>(map.at[offset]) < offset;
+                if (backward) {
+                    as.aluMemory64(Cmp, contextPointer, offsetof(JitContext, budget), 0);
+                    bailIf(LessEqual);
+                }
+                readOperand(RAX, 2);
+                as.shift64(ShiftRight, RAX, 32);
+                as.aluImm64(Sub, stackPointer, 2 * valueSize);
+                as.test32(RAX, RAX);
+                if (backward) {
+                    // conditions are numbered so that flipping the low bit
+                    // gives the opposite one
+                    unsigned notTaken = as.jumpIf(static_cast<Condition>(condition ^ 1));
+                    jumpTo(map.at[offset]);
+                    as.patch(notTaken, as.size());
+                } else {
+                    jumps.push_back(std::make_pair(as.jumpIf(condition), map.at[offset]));
+                }
+                break;
+            }
+
+            default:
+                // calls, returns, output and everything else is left to the
+                // interpreter
+                bail();
+        }
+    }
+
+}
+
+bool Jit::supported() {
+    return true;
+}
+
+Jit::CompiledFunction::~CompiledFunction() {
+    if (memory) munmap(memory, mappedSize);
+}
+
+void Jit::compile(const FunctionDef &function) {
+    FunctionState &state = states[index(function)];
+    state.attempted = true;
+    if (!function.verified) return;
+
+    // verify a copy of the function again to learn where its instructions
+    // are and where its jumps go
+    FunctionDef copy = function;
+    CodeMap map;
+    if (!verifyFunction(data.bytecode, functionEnd(data, function), copy, &map)) return;
+
+    std::unique_ptr<CompiledFunction> compiled(new CompiledFunction);
+    FunctionCompiler compiler(data.bytecode, function, map);
+    compiler.compile(compiled->entries);
+
+    const std::vector<uint8_t> &bytes = compiler.bytes();
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t size = (bytes.size() + pageSize - 1) / pageSize * pageSize;
+    void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return;
+    compiled->memory = static_cast<uint8_t*>(memory);
+    compiled->mappedSize = size;
+    std::memcpy(memory, bytes.data(), bytes.size());
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) return;
+
+    state.compiled = compiled.get();
+    compiledFunctions.push_back(std::move(compiled));
+}
+
+bool Jit::run(const FunctionDef &function, JitContext &context) const {
+    const CompiledFunction *compiled = states[index(function)].compiled;
+    if (!compiled) return false;
+    unsigned offset = context.ip - function.position;
+    if (offset >= compiled->entries.size() || compiled->entries[offset] < 0) return false;
+
+    context.entry = compiled->memory + compiled->entries[offset];
+    reinterpret_cast<void (*)(JitContext*)>(compiled->memory)(&context);
+    return true;
+}
+
+#else
+
+bool Jit::supported() {
+    return false;
+}
+
+Jit::CompiledFunction::~CompiledFunction() { }
+
+void Jit::compile(const FunctionDef &function) {
+    states[index(function)].attempted = true;
+}
+
+bool Jit::run(const FunctionDef&, JitContext&) const {
+    return false;
+}
+
+#endif
+
+Jit::Jit(const GameData &data, unsigned threshold)
+: data(data), threshold(threshold), states(data.functions.size(), FunctionState{0, false, nullptr})
+{ }
+
+Jit::~Jit() { }
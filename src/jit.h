@@ -0,0 +1,79 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "gamedata.h"
+
+// Passed between the runner and compiled code. The runner sets sp, locals,
+// ip and budget before entering; on leaving, compiled code has updated sp and
+// ip to show where the interpreter should carry on from, and budget to take
+// off the backward jumps it made.
+struct JitContext {
+    Value *sp;
+    Value *locals;
+    const void *entry;
+    unsigned ip;
+    int64_t budget;
+};
+
+// Translates the bytecode of verified functions that are run often into
+// x86-64 machine code. Compiled code works directly on the runner's stack and
+// handles pushes, stores, stack manipulation, integer arithmetic, comparisons
+// and jumps. At any other instruction, one that would raise a runtime error,
+// or a backward jump once the budget is used up, it returns to the runner with the stack exactly as it was before
+// that instruction so the interpreter can run it instead; calls and returns
+// go through the interpreter this way, then continue in compiled code.
+class Jit {
+public:
+    static const unsigned defaultThreshold = 1000;
+
+    // whether this build can generate code for the machine it runs on
+    static bool supported();
+
+    // functions are compiled once the number of calls to them plus backward
+    // jumps within them reaches threshold
+    Jit(const GameData &data, unsigned threshold);
+    ~Jit();
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    // note a call to or backward jump within a function, returning true if
+    // it now has compiled code to continue in
+    bool noteCall(const FunctionDef &function) {
+        return noteBackEdge(function);
+    }
+    bool noteBackEdge(const FunctionDef &function) {
+        FunctionState &state = states[index(function)];
+        if (++state.count >= threshold && !state.attempted) compile(function);
+        return state.compiled != nullptr;
+    }
+    bool isCompiled(const FunctionDef &function) const {
+        return states[index(function)].compiled != nullptr;
+    }
+
+    // run the compiled code of function starting from context.ip, returning
+    // false if there is none to start from there
+    bool run(const FunctionDef &function, JitContext &context) const;
+private:
+    struct CompiledFunction;
+    struct FunctionState {
+        unsigned count;
+        bool attempted;
+        CompiledFunction *compiled;
+    };
+
+    unsigned index(const FunctionDef &function) const {
+        return data.functions.indexOf(&function);
+    }
+    void compile(const FunctionDef &function);
+
+    const GameData &data;
+    unsigned threshold;
+    std::vector<FunctionState> states;
+    std::vector<std::unique_ptr<CompiledFunction>> compiledFunctions;
+};
+
+#endif
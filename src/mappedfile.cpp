@@ -0,0 +1,49 @@
+#include <fstream>
+#include <iterator>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAVE_MMAP
+#endif
+
+#include "mappedfile.h"
+
+bool MappedFile::open(const std::string &filename) {
+    close();
+
+#ifdef HAVE_MMAP
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void *result = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (result != MAP_FAILED) {
+            mapping = result;
+            length = info.st_size;
+        }
+    }
+    ::close(fd);
+    if (mapping) return true;
+#endif
+
+    // fall back to reading the file into memory
+    std::ifstream inf(filename, std::ios::binary);
+    if (!inf) return false;
+    buffer.assign(std::istreambuf_iterator<char>(inf), std::istreambuf_iterator<char>());
+    length = buffer.size();
+    return true;
+}
+
+void MappedFile::close() {
+#ifdef HAVE_MMAP
+    if (mapping) {
+        munmap(mapping, length);
+    }
+#endif
+    mapping = nullptr;
+    length = 0;
+    buffer.clear();
+}
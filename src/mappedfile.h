@@ -0,0 +1,36 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A read-only view of a whole file. Where the platform allows it, the file is
+// memory mapped so its pages are loaded on demand and shared with any other
+// process mapping the same file; otherwise it is read into a buffer.
+class MappedFile {
+public:
+    MappedFile() : mapping(nullptr), length(0) { }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() {
+        close();
+    }
+
+    bool open(const std::string &filename);
+    void close();
+
+    const uint8_t* data() const {
+        return mapping ? static_cast<const uint8_t*>(mapping) : buffer.data();
+    }
+    size_t size() const {
+        return length;
+    }
+private:
+    void *mapping;
+    size_t length;
+    std::vector<uint8_t> buffer;
+};
+
+#endif
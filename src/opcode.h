@@ -0,0 +1,90 @@
+#ifndef OPCODE_H
+#define OPCODE_H
+
+namespace Opcode {
+    enum Opcode {
+        Return       = 0,
+        Push0        = 1,
+        Push1        = 2,
+        PushNeg1     = 3,
+        Push8        = 4,
+        Push16       = 5,
+        Push32       = 6,
+        Store        = 7,
+        Say          = 10,
+        SayUnsigned  = 11,
+        SayChar      = 12,
+        StackPop     = 13, // remove the top item from the stack
+        StackDup     = 14, // duplicate the top item on the stack
+        StackPeek    = 15, // peek at the stack item X items from the top
+        StackSize    = 16, // get the current size of the stack
+        Call         = 17, // call a value as a function; directly followed
+                           // by Return, the callee replaces the caller's frame
+        CallMethod   = 18, // call an object property as a function
+        Self         = 19, // get object the current function is a property of
+        GetProp      = 20,
+        HasProp      = 21, // check if property is set on object
+        SetProp      = 22, // set object property to value
+        GetItem      = 23, // get item from list (index) or map (key)
+        HasItem      = 24, // check if index (for list) or key (for map) exists
+        GetSize      = 25, // get size of list or map
+        SetItem      = 26, // set item in list (by index) of map (by key); the
+                           // index equal to a list's size appends to it
+        TypeOf       = 27, // get value type
+        CompareTypes        = 30, // compare the types of two values and push the result
+        Compare             = 31, // compare two values and push the result
+        Jump                = 32, // unconditional jump
+        JumpZero            = 33, // jump if top of stack == 0
+        JumpNotZero         = 34, // jump if top of stack != 0
+        JumpLessThan        = 35, // jump if top of stack < 0
+        JumpLessThanEqual   = 36, // jump if top of stack <= 0
+        JumpGreaterThan     = 37, // jump if top of stack > 0
+        JumpGreaterThanEqual= 38, // jump if top of stack >= 0
+        Add          = 40,
+        Sub          = 41,
+        Mult         = 42,
+        Div          = 43,
+        WaitKey             = 50,
+        NewList      = 60, // make a new, empty list
+        NewMap       = 61, // make a new, empty map
+        NewObject    = 62, // make a new object with no properties
+
+        // Superinstructions, which the fusion pass puts in place of common
+        // sequences of the above when a gamefile is loaded (see fusion.h).
+        // They are never valid in a gamefile.
+        FirstFused                  = 0x80,
+        PushJump                    = 0x80, // Push32 JumpTarget, then a jump
+        PushJumpZero                = 0x81,
+        PushJumpNotZero             = 0x82,
+        PushJumpLessThan            = 0x83,
+        PushJumpLessThanEqual       = 0x84,
+        PushJumpGreaterThan         = 0x85,
+        PushJumpGreaterThanEqual    = 0x86,
+        CompareJumpZero             = 0x87, // Compare, Push32 JumpTarget, then
+        CompareJumpNotZero          = 0x88, // a conditional jump
+        CompareJumpLessThan         = 0x89,
+        CompareJumpLessThanEqual    = 0x8A,
+        CompareJumpGreaterThan      = 0x8B,
+        CompareJumpGreaterThanEqual = 0x8C,
+        AddImmediate                = 0x8D, // Push0, Push1 or PushNeg1 of an
+        SubImmediate                = 0x8E, // Integer or a local, then Add or Sub
+        AddLocal                    = 0x8F,
+        SubLocal                    = 0x90,
+        StoreLocal                  = 0x91, // Push0 or Push1 of a local, then Store
+        PushJump8                   = 0x92, // as PushJump and CompareJump above,
+        PushJumpZero8               = 0x93, // with a Push8 JumpTarget in place
+        PushJumpNotZero8            = 0x94, // of the Push32
+        PushJumpLessThan8           = 0x95,
+        PushJumpLessThanEqual8      = 0x96,
+        PushJumpGreaterThan8        = 0x97,
+        PushJumpGreaterThanEqual8   = 0x98,
+        CompareJumpZero8            = 0x99,
+        CompareJumpNotZero8         = 0x9A,
+        CompareJumpLessThan8        = 0x9B,
+        CompareJumpLessThanEqual8   = 0x9C,
+        CompareJumpGreaterThan8     = 0x9D,
+        CompareJumpGreaterThanEqual8= 0x9E,
+    };
+};
+
+#endif
@@ -0,0 +1,53 @@
+/* **************************************************************************
+ * Gamefile Optimizer
+ *
+ * Rewrites a gamefile with smaller, faster bytecode (see optimizer.h),
+ * leaving everything else as it was.
+ *
+ * Part of GTRPE by Gren Drake
+ * **************************************************************************/
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "gamedata.h"
+#include "gamefile.h"
+#include "optimizer.h"
+
+static void usage(const char *name) {
+    std::cerr << "USAGE: " << name << " [--version=N] infile outfile\n";
+    std::cerr << "  --version=N         format version to write (default 0)\n";
+}
+
+int main(int argc, char *argv[]) {
+    unsigned version = 0;
+    std::string files[2];
+    unsigned fileCount = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 10, "--version=") == 0 && arg.size() > 10) {
+            version = std::strtoul(arg.c_str() + 10, nullptr, 10);
+        } else if (arg[0] != '-' && fileCount < 2) {
+            files[fileCount++] = arg;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (fileCount != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    GameData data;
+    data.load(files[0]);
+    if (!data.gameLoaded) {
+        std::cerr << "Failed to load game data.\n";
+        return 1;
+    }
+    OptimizerStats stats = optimizeBytecode(data);
+    std::cout << "Rewrote " << stats.optimized << " of " << stats.functions
+              << " functions; bytecode went from " << stats.bytesBefore << " to "
+              << stats.bytesAfter << " bytes.\n";
+    return writeGameFile(data, files[1], version) ? 0 : 1;
+}
@@ -0,0 +1,396 @@
+/* **************************************************************************
+ * Bytecode Optimizer
+ *
+ * Rewrites each verified function in rounds until nothing more changes.
+ * Each round decodes the instructions the verifier found reachable, which
+ * drops dead code, then:
+ *
+ *   folds arithmetic, Compare and CompareTypes on two pushed constants
+ *   into a push of the result, where that can't fail at run time
+ *   turns a conditional jump on a pushed constant into a Jump, or removes it
+ *   points jumps at unconditional jumps straight at where those go, and
+ *   removes unconditional jumps to the next instruction
+ *
+ * and lays the code out again, with every push in its shortest form but
+ * those of jump targets. Those stay Push32, which the loader fuses with the
+ * jump after into one superinstruction (see fusion.h). Nothing is folded
+ * into the middle of a sequence something jumps into, and a function that
+ * pushes a jump target anywhere but straight before a jump is left alone.
+ *
+ * Part of GTRPE by Gren Drake
+ * **************************************************************************/
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <vector>
+
+#include "gamedata.h"
+#include "opcode.h"
+#include "optimizer.h"
+#include "verifier.h"
+
+namespace {
+
+    const unsigned maxRounds = 8;
+    // how many unconditional jumps in a row a jump is threaded through
+    const unsigned maxThreading = 16;
+
+    struct Instruction {
+        int opcode;
+        Value operand;      // what a push pushes
+        int target;         // for a push of a JumpTarget, the index of the
+                            // instruction it refers to
+        bool removed;
+    };
+    typedef std::vector<Instruction> Code;
+
+    bool isPush(int opcode) {
+        return opcode >= Opcode::Push0 && opcode <= Opcode::Push32;
+    }
+    bool isJump(int opcode) {
+        return opcode >= Opcode::Jump && opcode <= Opcode::JumpGreaterThanEqual;
+    }
+    bool isTargetPush(const Instruction &instruction) {
+        return isPush(instruction.opcode) && instruction.operand.type == Value::JumpTarget;
+    }
+    // a pushed value that means the same wherever the code ends up and
+    // whatever the locals hold
+    bool isConstant(const Instruction &instruction) {
+        return isPush(instruction.opcode) && instruction.operand.type != Value::LocalVar
+            && instruction.operand.type != Value::JumpTarget;
+    }
+
+    // the code has passed the verifier, so its operands are all there
+    Value readPush(const ByteStream &bytes, unsigned offset) {
+        ByteCursor cursor = bytes.cursor(offset);
+        int opcode = cursor.next_8();
+        Value value{static_cast<Value::Type>(cursor.next_8()), 0};
+        switch(opcode) {
+            case Opcode::Push0:     value.value = 0;    break;
+            case Opcode::Push1:     value.value = 1;    break;
+            case Opcode::PushNeg1:  value.value = -1;   break;
+            case Opcode::Push8:
+                value.value = static_cast<int8_t>(cursor.next_8());
+                break;
+            case Opcode::Push16:
+                value.value = static_cast<int16_t>(cursor.next_16());
+                break;
+            case Opcode::Push32:
+                value.value = cursor.next_32();
+                break;
+        }
+        return value;
+    }
+
+    unsigned pushSize(int value) {
+        if (value >= -1 && value <= 1) return 2;
+        if (value >= -128 && value < 128) return 3;
+        if (value >= -32768 && value < 32768) return 4;
+        return 6;
+    }
+
+    void writePush(ByteStream &out, const Value &value) {
+        switch(pushSize(value.value)) {
+            case 2:
+                out.add_8(value.value == 0 ? Opcode::Push0
+                          : value.value == 1 ? Opcode::Push1 : Opcode::PushNeg1);
+                out.add_8(value.type);
+                break;
+            case 3:
+                out.add_8(Opcode::Push8);
+                out.add_8(value.type);
+                out.add_8(value.value);
+                break;
+            case 4:
+                out.add_8(Opcode::Push16);
+                out.add_8(value.type);
+                out.add_16(value.value);
+                break;
+            default:
+                out.add_8(Opcode::Push32);
+                out.add_8(value.type);
+                out.add_32(value.value);
+        }
+    }
+
+    // the reachable instructions of a function that passed the verifier, in
+    // order. Fails if a jump target is pushed other than straight before the
+    // jump that uses it, as then where it points could be seen and the code
+    // can't be moved.
+    bool decode(const ByteStream &bytes, const CodeMap &map, Code &code) {
+        std::vector<int> indexAt(map.at.size(), -1);
+        for (unsigned offset = 0; offset < map.at.size(); ++offset) {
+            if (map.at[offset] == CodeMap::NotInstruction) continue;
+            indexAt[offset] = code.size();
+            Instruction instruction{bytes.read_8(offset), Value{Value::None, 0}, -1, false};
+            if (isPush(instruction.opcode)) instruction.operand = readPush(bytes, offset);
+            code.push_back(instruction);
+        }
+        for (unsigned i = 0; i < code.size(); ++i) {
+            Instruction &instruction = code[i];
+            if (!isTargetPush(instruction)) continue;
+            if (i + 1 == code.size() || !isJump(code[i + 1].opcode)) return false;
+            unsigned offset = instruction.operand.value;
+            if (offset >= indexAt.size() || indexAt[offset] < 0) return false;
+            instruction.target = indexAt[offset];
+        }
+        return true;
+    }
+
+    // the next instruction after index that has not been removed, or the end
+    unsigned following(const Code &code, unsigned index) {
+        do {
+            ++index;
+        } while (index < code.size() && code[index].removed);
+        return index;
+    }
+
+    // where a jump to index goes: what takes the place of a removed
+    // instruction is whatever follows it
+    unsigned live(const Code &code, unsigned index) {
+        return code[index].removed ? following(code, index) : index;
+    }
+
+    // what running opcode on v2 and then v1 pushed would leave, if it can't
+    // fail
+    bool evaluate(int opcode, const Value &v2, const Value &v1, Value &result) {
+        result = Value{Value::Integer, 0};
+        if (opcode == Opcode::CompareTypes) {
+            result.value = v1.type != v2.type ? 1 : 0;
+            return true;
+        }
+        if (opcode == Opcode::Compare) {
+            if (v1.type != v2.type) return false;
+            result.value = static_cast<uint32_t>(v2.value) - static_cast<uint32_t>(v1.value);
+            return true;
+        }
+        if (v1.type != Value::Integer || v2.type != Value::Integer) return false;
+        uint32_t a = v2.value, b = v1.value;
+        switch(opcode) {
+            case Opcode::Add:   result.value = a + b;   return true;
+            case Opcode::Sub:   result.value = a - b;   return true;
+            case Opcode::Mult:  result.value = a * b;   return true;
+            case Opcode::Div:
+                if (v1.value == 0 || (v1.value == -1 && v2.value == INT32_MIN)) return false;
+                result.value = v2.value / v1.value;
+                return true;
+        }
+        return false;
+    }
+
+    bool taken(int opcode, int value) {
+        switch(opcode) {
+            case Opcode::JumpZero:              return value == 0;
+            case Opcode::JumpNotZero:           return value != 0;
+            case Opcode::JumpLessThan:          return value < 0;
+            case Opcode::JumpLessThanEqual:     return value <= 0;
+            case Opcode::JumpGreaterThan:       return value > 0;
+            case Opcode::JumpGreaterThanEqual:  return value >= 0;
+        }
+        return true;
+    }
+
+    bool foldConstants(Code &code, const std::vector<bool> &targeted) {
+        bool changed = false;
+        for (unsigned a = 0; a < code.size(); ++a) {
+            if (code[a].removed) continue;
+            while (1) {
+                unsigned b = following(code, a), op = following(code, b);
+                if (op >= code.size() || targeted[b] || targeted[op]) break;
+                if (!isConstant(code[a]) || !isConstant(code[b])) break;
+                Value result;
+                if (!evaluate(code[op].opcode, code[a].operand, code[b].operand, result)) break;
+                code[a].operand = result;
+                code[b].removed = code[op].removed = true;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    bool foldBranches(Code &code, const std::vector<bool> &targeted) {
+        bool changed = false;
+        for (unsigned a = 0; a < code.size(); ++a) {
+            if (code[a].removed || !isConstant(code[a])) continue;
+            unsigned push = following(code, a), jump = following(code, push);
+            if (jump >= code.size() || targeted[push] || targeted[jump]) continue;
+            if (!isTargetPush(code[push]) || !isJump(code[jump].opcode)
+                    || code[jump].opcode == Opcode::Jump) {
+                continue;
+            }
+            if (taken(code[jump].opcode, code[a].operand.value)) {
+                code[jump].opcode = Opcode::Jump;
+            } else {
+                code[push].removed = code[jump].removed = true;
+            }
+            code[a].removed = true;
+            changed = true;
+        }
+        return changed;
+    }
+
+    // where a jump to index ends up, following unconditional jumps
+    unsigned destination(const Code &code, unsigned index) {
+        for (unsigned hops = 0; ; ++hops) {
+            index = live(code, index);
+            if (hops == maxThreading || index >= code.size()) return index;
+            unsigned jump = following(code, index);
+            if (!isTargetPush(code[index]) || jump >= code.size()
+                    || code[jump].opcode != Opcode::Jump) {
+                return index;
+            }
+            index = code[index].target;
+        }
+    }
+
+    bool threadJumps(Code &code, const std::vector<bool> &targeted) {
+        bool changed = false;
+        for (unsigned push = 0; push < code.size(); ++push) {
+            if (code[push].removed || !isTargetPush(code[push])) continue;
+            unsigned jump = following(code, push);
+            if (jump >= code.size() || !isJump(code[jump].opcode)) continue;
+            unsigned to = destination(code, code[push].target);
+            if (to >= code.size()) continue;
+            if (static_cast<int>(to) != code[push].target) {
+                code[push].target = to;
+                changed = true;
+            }
+            if (code[jump].opcode == Opcode::Jump && !targeted[jump]
+                    && to == following(code, jump)) {
+                code[push].removed = code[jump].removed = true;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    void rewrite(Code &code) {
+        std::vector<bool> targeted(code.size(), false);
+        bool changed = true;
+        while (changed) {
+            std::fill(targeted.begin(), targeted.end(), false);
+            for (const Instruction &instruction : code) {
+                if (instruction.removed || !isTargetPush(instruction)) continue;
+                unsigned target = live(code, instruction.target);
+                if (target < code.size()) targeted[target] = true;
+            }
+            changed = foldConstants(code, targeted);
+            changed = foldBranches(code, targeted) || changed;
+            changed = threadJumps(code, targeted) || changed;
+        }
+    }
+
+    // Lay out the code and write it. Every push of a jump target comes
+    // straight before the jump that uses it, and is written as Push32.
+    bool encode(const Code &code, ByteStream &out) {
+        std::vector<unsigned> offset(code.size() + 1, 0);
+        unsigned at = 0;
+        for (unsigned i = 0; i < code.size(); ++i) {
+            const Instruction &instruction = code[i];
+            offset[i] = at;
+            if (instruction.removed) continue;
+            if (!isPush(instruction.opcode)) {
+                at += 1;
+            } else if (isTargetPush(instruction)) {
+                if (live(code, instruction.target) >= code.size()) return false;
+                at += 6;
+            } else {
+                at += pushSize(instruction.operand.value);
+            }
+        }
+
+        for (unsigned i = 0; i < code.size(); ++i) {
+            const Instruction &instruction = code[i];
+            if (instruction.removed) continue;
+            if (!isPush(instruction.opcode)) {
+                out.add_8(instruction.opcode);
+            } else if (isTargetPush(instruction)) {
+                out.add_8(Opcode::Push32);
+                out.add_8(Value::JumpTarget);
+                out.add_32(offset[live(code, instruction.target)]);
+            } else {
+                writePush(out, instruction.operand);
+            }
+        }
+        return true;
+    }
+
+    bool sameBytes(const ByteStream &a, const ByteStream &b) {
+        return a.size() == b.size() && std::memcmp(a.bytes(), b.bytes(), a.size()) == 0;
+    }
+
+    // the best rewriting of a function's code that still passes the verifier
+    ByteStream optimizeFunction(const ByteStream &original, const FunctionDef &function) {
+        ByteStream best = original;
+        ByteStream current = original;
+        for (unsigned round = 0; ; ++round) {
+            FunctionDef check = function;
+            check.position = 0;
+            CodeMap map;
+            if (!verifyFunction(current, current.size(), check, &map)) break;
+            best = current;
+            if (round == maxRounds) break;
+
+            Code code;
+            if (!decode(current, map, code)) break;
+            rewrite(code);
+            ByteStream next;
+            if (!encode(code, next) || sameBytes(next, current)) break;
+            current = next;
+        }
+        return best;
+    }
+
+}
+
+OptimizerStats optimizeBytecode(GameData &data) {
+    OptimizerStats stats;
+    stats.bytesBefore = data.bytecode.size();
+
+    // each body of code, by where it starts, with one of the functions that
+    // starts there, if all of those passed the verifier
+    std::map<unsigned, const FunctionDef*> bodies;
+    for (const FunctionDef &function : data.functions) {
+        auto entry = bodies.emplace(function.position, &function);
+        if (!function.verified) entry.first->second = nullptr;
+    }
+    stats.functions = bodies.size();
+
+    // anything before the first function is kept as it is
+    ByteStream rewritten;
+    rewritten.reserve(stats.bytesBefore);
+    unsigned first = bodies.empty() ? stats.bytesBefore : bodies.begin()->first;
+    rewritten.append(data.bytecode.bytes(), std::min(first, stats.bytesBefore));
+
+    std::map<unsigned, unsigned> moved;
+    for (auto body = bodies.begin(); body != bodies.end(); ++body) {
+        unsigned start = body->first;
+        if (start >= stats.bytesBefore) {
+            moved[start] = rewritten.size() + (start - stats.bytesBefore);
+            continue;
+        }
+        auto next = std::next(body);
+        unsigned end = next == bodies.end() || next->first > stats.bytesBefore
+                     ? stats.bytesBefore : next->first;
+        ByteStream original;
+        original.view(data.bytecode.bytes() + start, end - start);
+        moved[start] = rewritten.size();
+        if (body->second) {
+            ByteStream optimized = optimizeFunction(original, *body->second);
+            if (!sameBytes(optimized, original)) ++stats.optimized;
+            rewritten.append(optimized);
+        } else {
+            rewritten.append(original);
+        }
+    }
+
+    for (FunctionDef &function : data.functions) {
+        function.position = moved[function.position];
+    }
+    data.bytecode = rewritten;
+    stats.bytesAfter = data.bytecode.size();
+    verifyFunctions(data);
+    return stats;
+}
@@ -0,0 +1,19 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+struct GameData;
+
+struct OptimizerStats {
+    unsigned functions = 0;     // distinct function bodies
+    unsigned optimized = 0;     // of those, how many were rewritten
+    unsigned bytesBefore = 0;
+    unsigned bytesAfter = 0;
+};
+
+// Rewrites the bytecode of every function that passed the verifier into a
+// smaller equivalent, then lays the functions out again and updates their
+// positions. Functions that did not pass are copied as they are. The game
+// data can then be written out with writeGameFile.
+OptimizerStats optimizeBytecode(GameData &data);
+
+#endif
@@ -0,0 +1,75 @@
+#include <cstdio>
+#include <cstring>
+
+#include "output.h"
+
+void StdoutSink::write(const char *text, size_t length) {
+    std::fwrite(text, 1, length, stdout);
+}
+
+void StdoutSink::flush() {
+    std::fflush(stdout);
+}
+
+void HashSink::write(const char *text, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        hash_ = (hash_ ^ static_cast<uint8_t>(text[i])) * 1099511628211ull;
+    }
+    size_ += length;
+    if (next) next->write(text, length);
+}
+
+
+void Output::setSink(std::unique_ptr<OutputSink> newSink) {
+    flush();
+    sink = std::move(newSink);
+}
+
+void Output::setBufferSize(size_t size) {
+    drain();
+    buffer.assign(size > 0 ? size : 1, 0);
+}
+
+void Output::write(std::string_view text) {
+    if (text.size() > buffer.size() - used) {
+        drain();
+        if (text.size() >= buffer.size()) {
+            sink->write(text.data(), text.size());
+            return;
+        }
+    }
+    std::memcpy(buffer.data() + used, text.data(), text.size());
+    used += text.size();
+}
+
+void Output::writeInt(int value) {
+    if (value < 0) {
+        write('-');
+        writeUnsigned(0u - static_cast<unsigned>(value));
+    } else {
+        writeUnsigned(value);
+    }
+}
+
+void Output::writeUnsigned(unsigned value) {
+    char digits[10];
+    char *end = digits + sizeof(digits);
+    char *start = end;
+    do {
+        *--start = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    write(std::string_view(start, end - start));
+}
+
+void Output::flush() {
+    drain();
+    sink->flush();
+}
+
+void Output::drain() {
+    if (used > 0) {
+        sink->write(buffer.data(), used);
+        used = 0;
+    }
+}
@@ -0,0 +1,109 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Somewhere for game output to go once it leaves Output's buffer.
+class OutputSink {
+public:
+    virtual ~OutputSink() { }
+    virtual void write(const char *text, size_t length) = 0;
+    virtual void flush() { }
+};
+
+class StdoutSink : public OutputSink {
+public:
+    void write(const char *text, size_t length) override;
+    void flush() override;
+};
+
+// collects output in memory, such as for a program embedding the runner
+class MemorySink : public OutputSink {
+public:
+    void write(const char *text, size_t length) override {
+        text_.append(text, length);
+    }
+    const std::string& text() const {
+        return text_;
+    }
+    void clear() {
+        text_.clear();
+    }
+private:
+    std::string text_;
+};
+
+// discards all output, such as for benchmarking
+class NullSink : public OutputSink {
+public:
+    void write(const char*, size_t) override { }
+};
+
+// keeps a 64-bit FNV-1a hash and count of the bytes of output, such as to
+// compare runs of a game without keeping what they printed, passing them on
+// to another sink if given one
+class HashSink : public OutputSink {
+public:
+    explicit HashSink(std::unique_ptr<OutputSink> next = nullptr)
+    : next(std::move(next)), hash_(14695981039346656037ull), size_(0)
+    { }
+    void write(const char *text, size_t length) override;
+    void flush() override {
+        if (next) next->flush();
+    }
+    uint64_t hash() const {
+        return hash_;
+    }
+    uint64_t size() const {
+        return size_;
+    }
+private:
+    std::unique_ptr<OutputSink> next;
+    uint64_t hash_;
+    uint64_t size_;
+};
+
+// Buffers game output and passes it to a sink in large blocks. Output is
+// only guaranteed to have reached the sink after a call to flush.
+class Output {
+public:
+    Output()
+    : sink(new StdoutSink), used(0), buffer(defaultBufferSize)
+    { }
+    Output(const Output&) = delete;
+    Output& operator=(const Output&) = delete;
+    ~Output() {
+        flush();
+    }
+
+    void setSink(std::unique_ptr<OutputSink> newSink);
+    // a smaller buffer saves memory where many games run at once
+    void setBufferSize(size_t size);
+    OutputSink& getSink() {
+        return *sink;
+    }
+
+    void write(char c) {
+        if (used == buffer.size()) drain();
+        buffer[used++] = c;
+    }
+    void write(std::string_view text);
+    void writeInt(int value);
+    void writeUnsigned(unsigned value);
+    void flush();
+private:
+    static const size_t defaultBufferSize = 65536;
+
+    void drain();
+
+    std::unique_ptr<OutputSink> sink;
+    size_t used;
+    std::vector<char> buffer;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Runs task(i) for each i below count on up to threads threads, the calling
+// thread among them, and returns once every one has finished. Tasks are
+// handed out one at a time, so they need not be the same size, and each runs
+// on one thread only; tasks must not touch what another is changing.
+template<class Task>
+void parallelFor(unsigned count, unsigned threads, Task task) {
+    std::atomic<unsigned> next(0);
+    auto work = [&next, count, &task]() {
+        for (unsigned i = next++; i < count; i = next++) {
+            task(i);
+        }
+    };
+    std::vector<std::thread> helpers;
+    for (unsigned i = 1; i < std::min(threads, count); ++i) {
+        helpers.push_back(std::thread(work));
+    }
+    work();
+    for (std::thread &helper : helpers) {
+        helper.join();
+    }
+}
+
+#endif
@@ -0,0 +1,255 @@
+/* **************************************************************************
+ * Opcode and Function Profiler
+ *
+ * Records opcode execution counts, per-function call counts and timings, and
+ * the number of calls along each caller to callee edge, then reports them
+ * sorted for reading or as tab-separated records for other tools.
+ *
+ * Part of GTRPE by Gren Drake
+ * **************************************************************************/
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+#include "gamedata.h"
+#include "opcode.h"
+#include "profiler.h"
+
+namespace {
+
+    const char* opcodeName(int opcode) {
+        switch(opcode) {
+            case Opcode::Return:                return "Return";
+            case Opcode::Push0:                 return "Push0";
+            case Opcode::Push1:                 return "Push1";
+            case Opcode::PushNeg1:              return "PushNeg1";
+            case Opcode::Push8:                 return "Push8";
+            case Opcode::Push16:                return "Push16";
+            case Opcode::Push32:                return "Push32";
+            case Opcode::Store:                 return "Store";
+            case Opcode::Say:                   return "Say";
+            case Opcode::SayUnsigned:           return "SayUnsigned";
+            case Opcode::SayChar:               return "SayChar";
+            case Opcode::StackPop:              return "StackPop";
+            case Opcode::StackDup:              return "StackDup";
+            case Opcode::StackPeek:             return "StackPeek";
+            case Opcode::StackSize:             return "StackSize";
+            case Opcode::Call:                  return "Call";
+            case Opcode::CallMethod:            return "CallMethod";
+            case Opcode::Self:                  return "Self";
+            case Opcode::GetProp:               return "GetProp";
+            case Opcode::HasProp:               return "HasProp";
+            case Opcode::SetProp:               return "SetProp";
+            case Opcode::GetItem:               return "GetItem";
+            case Opcode::HasItem:               return "HasItem";
+            case Opcode::GetSize:               return "GetSize";
+            case Opcode::SetItem:               return "SetItem";
+            case Opcode::TypeOf:                return "TypeOf";
+            case Opcode::CompareTypes:          return "CompareTypes";
+            case Opcode::Compare:               return "Compare";
+            case Opcode::Jump:                  return "Jump";
+            case Opcode::JumpZero:              return "JumpZero";
+            case Opcode::JumpNotZero:           return "JumpNotZero";
+            case Opcode::JumpLessThan:          return "JumpLessThan";
+            case Opcode::JumpLessThanEqual:     return "JumpLessThanEqual";
+            case Opcode::JumpGreaterThan:       return "JumpGreaterThan";
+            case Opcode::JumpGreaterThanEqual:  return "JumpGreaterThanEqual";
+            case Opcode::Add:                   return "Add";
+            case Opcode::Sub:                   return "Sub";
+            case Opcode::Mult:                  return "Mult";
+            case Opcode::Div:                   return "Div";
+            case Opcode::WaitKey:               return "WaitKey";
+            case Opcode::NewList:               return "NewList";
+            case Opcode::NewMap:                return "NewMap";
+            case Opcode::NewObject:             return "NewObject";
+            case Opcode::PushJump:              return "PushJump";
+            case Opcode::PushJumpZero:          return "PushJumpZero";
+            case Opcode::PushJumpNotZero:       return "PushJumpNotZero";
+            case Opcode::PushJumpLessThan:      return "PushJumpLessThan";
+            case Opcode::PushJumpLessThanEqual: return "PushJumpLessThanEqual";
+            case Opcode::PushJumpGreaterThan:   return "PushJumpGreaterThan";
+            case Opcode::PushJumpGreaterThanEqual:      return "PushJumpGreaterThanEqual";
+            case Opcode::CompareJumpZero:               return "CompareJumpZero";
+            case Opcode::CompareJumpNotZero:            return "CompareJumpNotZero";
+            case Opcode::CompareJumpLessThan:           return "CompareJumpLessThan";
+            case Opcode::CompareJumpLessThanEqual:      return "CompareJumpLessThanEqual";
+            case Opcode::CompareJumpGreaterThan:        return "CompareJumpGreaterThan";
+            case Opcode::CompareJumpGreaterThanEqual:   return "CompareJumpGreaterThanEqual";
+            case Opcode::AddImmediate:          return "AddImmediate";
+            case Opcode::SubImmediate:          return "SubImmediate";
+            case Opcode::AddLocal:              return "AddLocal";
+            case Opcode::SubLocal:              return "SubLocal";
+            case Opcode::StoreLocal:            return "StoreLocal";
+            case Opcode::PushJump8:             return "PushJump8";
+            case Opcode::PushJumpZero8:         return "PushJumpZero8";
+            case Opcode::PushJumpNotZero8:      return "PushJumpNotZero8";
+            case Opcode::PushJumpLessThan8:     return "PushJumpLessThan8";
+            case Opcode::PushJumpLessThanEqual8:        return "PushJumpLessThanEqual8";
+            case Opcode::PushJumpGreaterThan8:          return "PushJumpGreaterThan8";
+            case Opcode::PushJumpGreaterThanEqual8:     return "PushJumpGreaterThanEqual8";
+            case Opcode::CompareJumpZero8:              return "CompareJumpZero8";
+            case Opcode::CompareJumpNotZero8:           return "CompareJumpNotZero8";
+            case Opcode::CompareJumpLessThan8:          return "CompareJumpLessThan8";
+            case Opcode::CompareJumpLessThanEqual8:     return "CompareJumpLessThanEqual8";
+            case Opcode::CompareJumpGreaterThan8:       return "CompareJumpGreaterThan8";
+            case Opcode::CompareJumpGreaterThanEqual8:  return "CompareJumpGreaterThanEqual8";
+            default:                            return "unknown";
+        }
+    }
+
+    double microseconds(std::chrono::steady_clock::duration duration) {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    }
+
+}
+
+void Profiler::enter(const FunctionDef *function) {
+    lastOpcode = -1;
+    int caller = activations.empty() ? -1 : activations.back().ident;
+    ++edges[std::make_pair(caller, function->ident)];
+    start(function);
+}
+
+void Profiler::tailCall(const FunctionDef *function) {
+    int caller = activations.empty() ? -1 : activations.back().ident;
+    ++edges[std::make_pair(caller, function->ident)];
+    leave();
+    start(function);
+}
+
+void Profiler::start(const FunctionDef *function) {
+    FunctionProfile &profile = functions[function->ident];
+    ++profile.calls;
+    ++profile.active;
+    activations.push_back(Activation{function->ident, &profile, Clock::now(),
+                                     Clock::duration::zero()});
+    current = &profile;
+}
+
+void Profiler::leave() {
+    lastOpcode = -1;
+    if (activations.empty()) return;
+    Activation activation = activations.back();
+    activations.pop_back();
+
+    Clock::duration elapsed = Clock::now() - activation.start;
+    FunctionProfile &profile = *activation.profile;
+    --profile.active;
+    if (profile.active == 0) profile.inclusive += elapsed;
+    profile.exclusive += elapsed - activation.children;
+
+    if (activations.empty()) {
+        current = nullptr;
+    } else {
+        activations.back().children += elapsed;
+        current = activations.back().profile;
+    }
+}
+
+void Profiler::unwind(unsigned depth) {
+    while (activations.size() > depth) {
+        leave();
+    }
+}
+
+void Profiler::report(std::ostream &out) const {
+    uint64_t totalOpcodes = 0;
+    std::vector<std::pair<uint64_t, int>> opcodes;
+    for (unsigned i = 0; i < opcodeCounts.size(); ++i) {
+        totalOpcodes += opcodeCounts[i];
+        if (opcodeCounts[i]) opcodes.push_back(std::make_pair(opcodeCounts[i], i));
+    }
+    std::sort(opcodes.rbegin(), opcodes.rend());
+
+    out << "\n## Opcodes (" << totalOpcodes << " executed)\n";
+    out << std::setw(28) << std::left << "opcode" << std::right
+        << std::setw(14) << "count" << std::setw(9) << "share" << '\n';
+    for (const auto &entry : opcodes) {
+        out << std::setw(28) << std::left << opcodeName(entry.second) << std::right
+            << std::setw(14) << entry.first
+            << std::setw(8) << std::fixed << std::setprecision(2)
+            << 100.0 * entry.first / totalOpcodes << "%\n";
+    }
+
+    std::vector<std::pair<uint64_t, int>> pairs;
+    for (unsigned i = 0; i < pairCounts.size(); ++i) {
+        if (pairCounts[i]) pairs.push_back(std::make_pair(pairCounts[i], i));
+    }
+    std::sort(pairs.rbegin(), pairs.rend());
+    if (pairs.size() > reportedPairs) pairs.resize(reportedPairs);
+
+    out << "\n## Opcode pairs (most frequent " << reportedPairs << ")\n";
+    for (const auto &entry : pairs) {
+        std::string pair = opcodeName(entry.second >> 8);
+        pair += ' ';
+        pair += opcodeName(entry.second & 0xFF);
+        out << std::setw(52) << std::left << pair << std::right
+            << std::setw(14) << entry.first
+            << std::setw(8) << std::fixed << std::setprecision(2)
+            << 100.0 * entry.first / totalOpcodes << "%\n";
+    }
+
+    std::vector<std::pair<Clock::duration, int>> byTime;
+    for (const auto &entry : functions) {
+        byTime.push_back(std::make_pair(entry.second.exclusive, entry.first));
+    }
+    std::sort(byTime.rbegin(), byTime.rend());
+
+    out << "\n## Functions (by exclusive time)\n";
+    out << std::setw(10) << "function" << std::setw(12) << "calls"
+        << std::setw(14) << "opcodes" << std::setw(16) << "inclusive us"
+        << std::setw(16) << "exclusive us" << '\n';
+    for (const auto &entry : byTime) {
+        const FunctionProfile &profile = functions.at(entry.second);
+        out << std::setw(10) << entry.second << std::setw(12) << profile.calls
+            << std::setw(14) << profile.opcodes
+            << std::setw(16) << std::setprecision(1) << microseconds(profile.inclusive)
+            << std::setw(16) << microseconds(profile.exclusive) << '\n';
+    }
+
+    std::vector<std::pair<uint64_t, std::pair<int, int>>> byCount;
+    for (const auto &entry : edges) {
+        byCount.push_back(std::make_pair(entry.second, entry.first));
+    }
+    std::sort(byCount.rbegin(), byCount.rend());
+
+    out << "\n## Calls (caller -> callee)\n";
+    for (const auto &entry : byCount) {
+        out << std::setw(10);
+        if (entry.second.first < 0) out << "(runner)";
+        else                        out << entry.second.first;
+        out << " -> " << std::setw(10) << std::left << entry.second.second
+            << std::right << std::setw(12) << entry.first << '\n';
+    }
+    out << std::defaultfloat;
+}
+
+bool Profiler::writeFile(const std::string &filename) const {
+    std::ofstream out(filename);
+    if (!out) return false;
+
+    for (unsigned i = 0; i < opcodeCounts.size(); ++i) {
+        if (opcodeCounts[i]) {
+            out << "opcode\t" << i << '\t' << opcodeName(i) << '\t' << opcodeCounts[i] << '\n';
+        }
+    }
+    for (unsigned i = 0; i < pairCounts.size(); ++i) {
+        if (pairCounts[i]) {
+            out << "pair\t" << (i >> 8) << '\t' << (i & 0xFF) << '\t' << opcodeName(i >> 8)
+                << '\t' << opcodeName(i & 0xFF) << '\t' << pairCounts[i] << '\n';
+        }
+    }
+    for (const auto &entry : functions) {
+        const FunctionProfile &profile = entry.second;
+        out << "function\t" << entry.first << '\t' << profile.calls << '\t'
+            << profile.opcodes << '\t'
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(profile.inclusive).count() << '\t'
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(profile.exclusive).count() << '\n';
+    }
+    for (const auto &entry : edges) {
+        out << "call\t" << entry.first.first << '\t' << entry.first.second
+            << '\t' << entry.second << '\n';
+    }
+    return static_cast<bool>(out);
+}
@@ -0,0 +1,78 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct FunctionDef;
+
+// Counts what the interpreter does while a game runs: how often each opcode
+// is executed, and each pair of opcodes one after the other within a
+// function, how often each function is called and from where, and how
+// much time is spent in each function both including (inclusive) and
+// excluding (exclusive) the functions it calls. Only built into the runner
+// when compiled with ENABLE_PROFILER ("make PROFILE=1").
+class Profiler {
+public:
+    Profiler()
+    : opcodeCounts(256, 0), pairCounts(256 * 256, 0), lastOpcode(-1), current(nullptr)
+    { }
+
+    void countOpcode(int opcode) {
+        ++opcodeCounts[opcode];
+        if (lastOpcode >= 0) ++pairCounts[lastOpcode << 8 | opcode];
+        lastOpcode = opcode;
+        if (current) ++current->opcodes;
+    }
+    void enter(const FunctionDef *function);
+    void leave();
+    // a call made in place of the running function; the edge is recorded
+    // from that function, whose own time ends here, to the one called
+    void tailCall(const FunctionDef *function);
+    // discard the records of calls abandoned when a runtime error unwound
+    // the call stack down to depth
+    void unwind(unsigned depth);
+
+    void report(std::ostream &out) const;
+    bool writeFile(const std::string &filename) const;
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct FunctionProfile {
+        uint64_t calls = 0;
+        uint64_t opcodes = 0;
+        Clock::duration inclusive = Clock::duration::zero();
+        Clock::duration exclusive = Clock::duration::zero();
+        // number of calls to this function currently on the stack, so that
+        // recursive calls don't count the same time twice
+        unsigned active = 0;
+    };
+    struct Activation {
+        int ident;
+        FunctionProfile *profile;
+        Clock::time_point start;
+        Clock::duration children;
+    };
+
+    void start(const FunctionDef *function);
+
+    // how many pairs of opcodes to list in the report
+    static const unsigned reportedPairs = 20;
+
+    std::vector<uint64_t> opcodeCounts;
+    // by the first opcode of each pair times 256 plus the second; a call or
+    // return ends a run of pairs
+    std::vector<uint64_t> pairCounts;
+    int lastOpcode;
+    std::map<int, FunctionProfile> functions;
+    std::map<std::pair<int, int>, uint64_t> edges;
+    std::vector<Activation> activations;
+    FunctionProfile *current;
+};
+
+#endif
@@ -1,64 +1,256 @@
 #include <array>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <map>
+#include <memory>
 #include <vector>
 
+#include "batch.h"
+#include "differential.h"
 #include "gamedata.h"
 #include "runtime_error.h"
 #include "runner.h"
+#include "server.h"
 
 
 void Runner::callMain() {
-    Value v = callFunction(data.mainFunction);
-    std::cout << "\nMAIN RETURNED: ";
+    Value v = callFunction(data->mainFunction);
+    output.write("\nMAIN RETURNED: ");
     say(v);
-    std::cout << '\n';
+    output.write('\n');
+    output.flush();
 }
 
-void Runner::say(unsigned intValue) const {
-    std::cout << intValue;
+void Runner::say(unsigned intValue) {
+    output.writeUnsigned(intValue);
 }
 
-void Runner::say(const Value &value) const {
+void Runner::say(const Value &value) {
     switch(value.type) {
         case Value::String: {
-            const StringDef &stringDef = data.getString(value.value);
-            std::cout << stringDef.text;
+            const StringDef &stringDef = data->getString(value.value);
+            output.write(strings.get(*data, stringDef));
             break;
         }
         case Value::Integer:
-            std::cout << value.value;
+            output.writeInt(value.value);
             break;
-        default:
-            std::cout << '<' << value.type;
+        case Value::Symbol:
+            output.write(data->getSymbol(value.value));
+            break;
+        default: {
+            std::stringstream ss;
+            ss << '<' << value.type;
             if (value.type != Value::None) {
-                std::cout << ' ' << value.value;
+                ss << ' ' << value.value;
             }
-            std::cout << '>';
+            ss << '>';
+            output.write(ss.str());
+        }
     }
 }
 
+static void usage(const char *name) {
+    std::cerr << "USAGE: " << name << " [options] [gamefile]\n";
+    std::cerr << "  --batch=LIST        play the game through each transcript named in the\n";
+    std::cerr << "                      file LIST, one per line, writing a line of results\n";
+    std::cerr << "                      for each (see batch.h)\n";
+    std::cerr << "  --batch-output=DIR  also write what each batch playthrough printed to\n";
+    std::cerr << "                      DIR/TRANSCRIPT.out\n";
+    std::cerr << "  --diff              run the game on the reference interpreter and as it\n";
+    std::cerr << "                      would otherwise run, in lockstep, stopping where\n";
+    std::cerr << "                      they first differ (see differential.h)\n";
+    std::cerr << "  --jit[=THRESHOLD]   compile functions run THRESHOLD times (default\n";
+    std::cerr << "                      " << Jit::defaultThreshold << ") to machine code\n";
+    std::cerr << "  --load-only         load and verify the gamefile, then exit\n";
+    std::cerr << "  --no-fusion         run the bytecode without fusing common sequences into\n";
+    std::cerr << "                      superinstructions, as when counting opcode pairs\n";
+    std::cerr << "  --null-output       discard game output (not with --batch, --diff or\n";
+    std::cerr << "                      --server)\n";
+    std::cerr << "  --profile[=FILE]    report opcode and function profile, writing\n";
+    std::cerr << "                      records to FILE (default profile.tsv; not with\n";
+    std::cerr << "                      --batch, --diff or --server)\n";
+    std::cerr << "  --server            run many sessions of the game, driven by commands\n";
+    std::cerr << "                      on standard input (see server.h)\n";
+    std::cerr << "  --snapshots         with --diff, also save, reload, and take and undo\n";
+    std::cerr << "                      each turn at every WaitKey (see differential.h)\n";
+    std::cerr << "  --threads=N         number of sessions the server, or playthroughs a\n";
+    std::cerr << "                      batch, runs at once\n";
+    std::cerr << "                      (default one per core)\n";
+    std::cerr << "  --time-slice=N      calls and backward jumps each server session makes\n";
+    std::cerr << "                      before giving others a turn (default " << ServerOptions().timeSlice << ")\n";
+    std::cerr << "  --turn-limit=N      calls and backward jumps a turn of a batch\n";
+    std::cerr << "                      playthrough or differential run may make before\n";
+    std::cerr << "                      it is stopped\n";
+}
+
 int main(int argc, char *argv[]) {
     std::string gamefile = "game.bin";
-    if (argc == 2) gamefile = argv[1];
-    else if (argc > 2) {
-        std::cerr << "USAGE: " << argv[0] << " [gamefile]\n";
+    bool haveGamefile = false;
+    bool useJit = false;
+    unsigned jitThreshold = Jit::defaultThreshold;
+    bool loadOnly = false;
+    bool diffMode = false;
+    bool snapshots = false;
+    bool nullOutput = false;
+    bool fusion = true;
+    std::string profileFile;
+    bool serverMode = false;
+    unsigned threads = 0;
+    int64_t timeSlice = ServerOptions().timeSlice;
+    std::string batchList;
+    std::string batchOutput;
+    int64_t turnLimit = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--jit") {
+            useJit = true;
+        } else if (arg.compare(0, 6, "--jit=") == 0 && arg.size() > 6) {
+            useJit = true;
+            jitThreshold = std::strtoul(arg.c_str() + 6, nullptr, 10);
+        } else if (arg.compare(0, 8, "--batch=") == 0 && arg.size() > 8) {
+            batchList = arg.substr(8);
+        } else if (arg.compare(0, 15, "--batch-output=") == 0 && arg.size() > 15) {
+            batchOutput = arg.substr(15);
+        } else if (arg == "--diff") {
+            diffMode = true;
+        } else if (arg == "--load-only") {
+            loadOnly = true;
+        } else if (arg == "--no-fusion") {
+            fusion = false;
+        } else if (arg == "--null-output") {
+            nullOutput = true;
+        } else if (arg == "--profile") {
+            profileFile = "profile.tsv";
+        } else if (arg.compare(0, 10, "--profile=") == 0 && arg.size() > 10) {
+            profileFile = arg.substr(10);
+        } else if (arg == "--server") {
+            serverMode = true;
+        } else if (arg == "--snapshots") {
+            snapshots = true;
+        } else if (arg.compare(0, 10, "--threads=") == 0 && arg.size() > 10) {
+            threads = std::strtoul(arg.c_str() + 10, nullptr, 10);
+        } else if (arg.compare(0, 13, "--time-slice=") == 0 && arg.size() > 13) {
+            timeSlice = std::strtoll(arg.c_str() + 13, nullptr, 10);
+        } else if (arg.compare(0, 13, "--turn-limit=") == 0 && arg.size() > 13) {
+            turnLimit = std::strtoll(arg.c_str() + 13, nullptr, 10);
+        } else if (arg[0] != '-' && !haveGamefile) {
+            gamefile = arg;
+            haveGamefile = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (useJit && !Jit::supported()) {
+        std::cerr << "The JIT is only available on x86-64 Linux.\n";
+        return 1;
+    }
+#ifndef ENABLE_PROFILER
+    if (!profileFile.empty()) {
+        std::cerr << "This runner was built without profiling support; rebuild with \"make PROFILE=1\".\n";
+        return 1;
+    }
+#endif
+
+    // batch, differential and server runs keep or compare each game's output
+    // themselves and run many runners, so neither of these applies to them
+    const bool sharedData = !batchList.empty() || diffMode || serverMode;
+    if (sharedData && (nullOutput || !profileFile.empty())) {
+        std::cerr << "--null-output and --profile cannot be used with --batch, --diff or --server.\n";
+        usage(argv[0]);
         return 1;
     }
 
+    std::shared_ptr<GameData> data;
+    if (sharedData) {
+        data = std::make_shared<GameData>();
+        data->load(gamefile);
+        if (!data->gameLoaded) {
+            std::cerr << "Failed to load game data.\n";
+            return 1;
+        }
+        if (loadOnly) return 0;
+    }
+
+    if (!batchList.empty()) {
+        std::ifstream list(batchList);
+        if (!list) {
+            std::cerr << "Could not open ~" << batchList << "~.\n";
+            return 1;
+        }
+        std::vector<std::string> transcripts;
+        std::string line;
+        while (std::getline(list, line)) {
+            if (!line.empty()) transcripts.push_back(line);
+        }
+        BatchOptions options;
+        options.threads = threads;
+        options.useJit = useJit;
+        options.jitThreshold = jitThreshold;
+        options.fusion = fusion;
+        options.turnLimit = turnLimit;
+        options.outputDirectory = batchOutput;
+        Batch batch(data, options, std::cout);
+        return batch.run(transcripts) ? 0 : 1;
+    }
+
+    if (diffMode) {
+        DifferentialOptions options;
+        options.useJit = useJit;
+        options.jitThreshold = jitThreshold;
+        options.fusion = fusion;
+        options.turnLimit = turnLimit;
+        options.snapshots = snapshots;
+        StdinSource input;
+        return runDifferential(data, options, input, std::cout, std::cerr) ? 0 : 1;
+    }
+
+    if (serverMode) {
+        ServerOptions options;
+        options.threads = threads;
+        options.useJit = useJit;
+        options.jitThreshold = jitThreshold;
+        options.fusion = fusion;
+        options.timeSlice = timeSlice;
+        Server server(data, options, std::cin, std::cout);
+        server.run();
+        return 0;
+    }
+
     Runner runner;
+    if (nullOutput) {
+        runner.getOutput().setSink(std::unique_ptr<OutputSink>(new NullSink));
+    }
     if (!runner.load(gamefile)) {
         std::cerr << "Failed to load game data.\n";
         return 1;
     }
+    if (loadOnly) return 0;
+    if (!fusion) runner.disableFusion();
+    if (useJit) runner.enableJit(jitThreshold);
+#ifdef ENABLE_PROFILER
+    if (!profileFile.empty()) runner.enableProfiler();
+#endif
 
+    int exitCode = 0;
     try {
         runner.callMain();
     } catch (RuntimeError &e) {
+        runner.getOutput().flush();
         std::cerr << "RUNTIME ERROR: " << e.what() << '\n';
-        return 1;
+        exitCode = 1;
     }
-    return 0;
-}
\ No newline at end of file
+
+#ifdef ENABLE_PROFILER
+    if (const Profiler *profiler = runner.getProfiler()) {
+        profiler->report(std::cerr);
+        if (!profiler->writeFile(profileFile)) {
+            std::cerr << "Could not write profile to ~" << profileFile << "~.\n";
+        }
+    }
+#endif
+    return exitCode;
+}
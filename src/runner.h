@@ -1,25 +1,235 @@
 #ifndef RUNNER_H
 #define RUNNER_H
 
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <memory>
 #include <string>
+#include <vector>
 #include "gamedata.h"
+#include "heap.h"
+#include "input.h"
+#include "jit.h"
+#include "output.h"
+#include "stringcache.h"
+#ifdef ENABLE_PROFILER
+#include "profiler.h"
+#endif
 
 struct Value;
 
+struct Frame {
+    const FunctionDef *function;
+    // where the function continues from while it is not the running frame
+    unsigned ip;
+    // index of the first local and of the bottom of the working stack within
+    // Runner::stack
+    unsigned base;
+    unsigned stackBase;
+};
+
+// Remembers where the last property read at a GetProp instruction was found,
+// so that repeating it on an object of the same shape skips the lookup.
+struct PropertyCacheEntry {
+    unsigned site;
+    unsigned propId;
+    const Shape *shape;
+    int slot;
+};
+
+// Why Runner::resume returned, or what a started function is ready to do.
+enum class RunStatus {
+    Finished,           // the function returned; see Runner::getResult
+    Ready,              // started or given a key, and not yet resumed
+    WaitingForKey,      // stopped at WaitKey; call giveKey, then resume
+    OutOfBudget         // used up the budget given to resume
+};
+
 class Runner {
 public:
+    // budget for running without a limit
+    static const int64_t unlimited = std::numeric_limits<int64_t>::max();
+
+    Runner()
+    : input(new StdinSource), stack(initialStackSize), stackTop(0), propertyCacheMask(0),
+      fusion(true), reference(false), budget(unlimited), suspendable(false), status(RunStatus::Finished),
+      checkpointLimit(defaultCheckpointLimit)
+    {
+        frames.reserve(initialFrameCount);
+    }
+    Runner(const Runner&) = delete;
+    Runner& operator=(const Runner&) = delete;
+
     bool load(const std::string &filename) {
-        data.load(filename);
-        return data.gameLoaded;
+        std::shared_ptr<GameData> loaded = std::make_shared<GameData>();
+        loaded->load(filename);
+        if (!loaded->gameLoaded) return false;
+        attach(loaded);
+        return true;
+    }
+    // run a game that has already been loaded, which may also be in use by
+    // other runners
+    void attach(std::shared_ptr<const GameData> gameData) {
+        data = std::move(gameData);
+        heap.load(*data);
+        strings.clear();
+        checkpoints.clear();
+        resetPropertyCache();
+        jit.reset();
+    }
+    const std::shared_ptr<const GameData>& getGameData() const {
+        return data;
     }
 
     void callMain();
     Value callFunction(int ident, const std::vector<Value> &arguments = {});
 
-    void say(unsigned intValue) const;
-    void say(const Value &value) const;
+    // Run a function a piece at a time, leaving the host free between pieces.
+    // start sets up the call; each resume then runs it until it returns,
+    // reaches a WaitKey, or has made budget calls and backward jumps (the
+    // points every loop and recursion passes through), keeping its frames
+    // for the next resume. A WaitKey reached by a function run with
+    // callFunction reads from the input source instead.
+    void start(int ident, const std::vector<Value> &arguments = {});
+    void startMain() {
+        start(data->mainFunction);
+    }
+    RunStatus resume(int64_t budget = unlimited);
+    // supply what the player typed to a function waiting for a key
+    void giveKey(const std::string &word);
+    RunStatus getStatus() const {
+        return status;
+    }
+    // the value returned by the last function started, once Finished
+    const Value& getResult() const {
+        return lastResult;
+    }
+
+    // Checkpoints record the state of the game so that it can go back to it,
+    // such as to undo a turn. Making one copies the stack, and otherwise
+    // costs only as much as the lists, maps and objects changed after it.
+    // Once there are more than the limit, the oldest is dropped. Use these
+    // only between runs, not while one is in progress.
+    void checkpoint();
+    // go back to the latest checkpoint and discard it, returning false if
+    // there is none
+    bool restoreCheckpoint();
+    unsigned checkpointCount() const {
+        return checkpoints.size();
+    }
+    void setCheckpointLimit(unsigned limit);
+
+    // write the state of the game to a file, or replace it with one written
+    // by a runner of the same gamefile; checkpoints are not included
+    bool saveState(const std::string &filename) const;
+    bool loadState(const std::string &filename);
+    // the same in two steps, so that the file can be written or read at a
+    // different time from the state; filename is only used in messages
+    void writeSave(ByteStream &out) const;
+    static bool writeSaveFile(const ByteStream &out, const std::string &filename);
+    static bool readSaveFile(const std::string &filename, ByteStream &saved);
+    bool readSave(const uint8_t *bytes, size_t size, const std::string &filename);
+    // write the state as saveState does, without the header, such as to
+    // compare two runners of the same game
+    void writeState(ByteStream &out) const;
+    // the frames of the function running, innermost last, and the values on
+    // the stack beneath them
+    const std::vector<Frame>& getFrames() const {
+        return frames;
+    }
+    std::vector<Value> getStack() const {
+        return std::vector<Value>(stack.begin(), stack.begin() + stackTop);
+    }
+
+    // finish any collection of unreachable lists, maps and objects that is in
+    // progress, or do a whole one; this otherwise happens a little at a time
+    // as new ones are made. Values held outside the runner don't count as
+    // references to them.
+    void collectGarbage();
+    unsigned madeCount() const {
+        return heap.madeCount();
+    }
+
+    Output& getOutput() {
+        return output;
+    }
+    void setInput(std::unique_ptr<InputSource> newInput) {
+        input = std::move(newInput);
+    }
+    // run the bytecode as it was loaded, rather than with common sequences
+    // fused into superinstructions; see fusion.h
+    void disableFusion() {
+        fusion = false;
+    }
+    // run every function with the checked interpreter on the bytecode as
+    // loaded, never fused or compiled, as the reference that the faster ways
+    // of running are tested against; see differential.h
+    void useReferenceInterpreter() {
+        reference = true;
+    }
+    // compile hot functions to machine code; call after loading
+    void enableJit(unsigned threshold = Jit::defaultThreshold) {
+        jit.reset(new Jit(*data, threshold));
+    }
+#ifdef ENABLE_PROFILER
+    void enableProfiler() {
+        profiler.reset(new Profiler);
+    }
+    const Profiler* getProfiler() const {
+        return profiler.get();
+    }
+#endif
+    void say(unsigned intValue);
+    void say(const Value &value);
 private:
-    GameData data;
+    static const unsigned initialStackSize = 4096;
+    static const unsigned initialFrameCount = 256;
+    static const unsigned defaultCheckpointLimit = 100;
+
+    struct Checkpoint {
+        std::vector<Value> stack;
+        std::vector<Frame> frames;
+        RunStatus status;
+        Value lastResult;
+    };
+
+    void resetPropertyCache();
+    void reserveStack(unsigned needed);
+    Value make(Value::Type type);
+    void markRoots();
+    void pushFrame(const FunctionDef &function, unsigned argCount);
+    void enterFunction(const FunctionDef &function, unsigned argCount);
+    void enterTailCall(const FunctionDef &function, unsigned argCount);
+    RunStatus execute(unsigned entryDepth, Value &result);
+    bool runCompiled(unsigned entryDepth, Value &result);
+    template<bool checked>
+    bool run(unsigned entryDepth, Value &result);
+
+    std::shared_ptr<const GameData> data;
+    Heap heap;
+    StringCache strings;
+    Output output;
+    std::unique_ptr<InputSource> input;
+    std::vector<Value> stack;
+    unsigned stackTop;
+    std::vector<Frame> frames;
+    std::vector<PropertyCacheEntry> propertyCache;
+    unsigned propertyCacheMask;
+    std::unique_ptr<Jit> jit;
+    bool fusion;
+    bool reference;
+    // calls and backward jumps left before suspending, whether WaitKey may
+    // suspend, and why execution last stopped
+    int64_t budget;
+    bool suspendable;
+    RunStatus status;
+    Value lastResult;
+    std::deque<Checkpoint> checkpoints;
+    unsigned checkpointLimit;
+#ifdef ENABLE_PROFILER
+    std::unique_ptr<Profiler> profiler;
+#endif
 };
 
 #endif
@@ -0,0 +1,311 @@
+/* **************************************************************************
+ * Multi-Session Game Server
+ *
+ * Loads a game once and runs many sessions of it on a pool of worker
+ * threads. Each session's Runner shares the immutable GameData and keeps only
+ * its own stacks and whatever lists, maps and objects it has changed.
+ *
+ * Part of GTRPE by Gren Drake
+ * **************************************************************************/
+#include <iostream>
+#include <sstream>
+
+#include "runner.h"
+#include "runtime_error.h"
+#include "server.h"
+
+namespace {
+
+    // size of each session's output buffer, which is flushed at the end of
+    // every turn anyway
+    const size_t sessionBufferSize = 4096;
+
+    std::string escape(const char *text, size_t length) {
+        std::string result;
+        result.reserve(length);
+        for (size_t i = 0; i < length; ++i) {
+            switch(text[i]) {
+                case '\\':  result += "\\\\";   break;
+                case '\n':  result += "\\n";    break;
+                case '\r':  result += "\\r";    break;
+                default:    result += text[i];
+            }
+        }
+        return result;
+    }
+
+    class SessionSink : public OutputSink {
+    public:
+        SessionSink(Server &server, const std::string &id)
+        : server(server), id(id)
+        { }
+        void write(const char *text, size_t length) override {
+            server.send(id, "output " + escape(text, length));
+        }
+    private:
+        Server &server;
+        std::string id;
+    };
+
+}
+
+// A session is scheduled while it is queued for or taking a turn on a
+// worker; otherwise it is waiting for input. Everything but the runner is
+// guarded by the server's mutex, and the runner belongs to whichever thread
+// scheduled or is running it.
+struct Server::Session {
+    Session(const std::string &id)
+    : id(id), scheduled(false), closed(false)
+    { }
+
+    std::string id;
+    Runner runner;
+    std::deque<std::string> words;
+    bool scheduled;
+    bool closed;
+};
+
+Server::Server(std::shared_ptr<const GameData> data, const ServerOptions &options,
+               std::istream &in, std::ostream &out)
+: data(data), options(options), in(in), out(out), inputEnded(false)
+{
+    unsigned threads = options.threads;
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    for (unsigned i = 0; i < threads; ++i) {
+        workers.push_back(std::thread(&Server::worker, this));
+    }
+}
+
+Server::~Server() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &entry : sessions) {
+            entry.second->closed = true;
+        }
+    }
+    endInput();
+    for (std::thread &worker : workers) {
+        if (worker.joinable()) worker.join();
+    }
+}
+
+void Server::run() {
+    std::string line;
+    while (std::getline(in, line)) {
+        handle(line);
+    }
+
+    endInput();
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+void Server::send(const std::string &sessionId, const std::string &message) {
+    std::lock_guard<std::mutex> lock(outMutex);
+    if (!sessionId.empty()) out << sessionId << ' ';
+    out << message << '\n';
+    out.flush();
+}
+
+void Server::handle(const std::string &line) {
+    std::istringstream fields(line);
+    std::string command, id;
+    fields >> command >> id;
+    if (command.empty()) return;
+    if (id.empty()) {
+        send("", "error expected a session id: " + line);
+        return;
+    }
+
+    if (command == "save" || command == "restore") {
+        std::string filename;
+        fields >> filename;
+        transfer(command == "save", id, filename);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto existing = sessions.find(id);
+    if (command == "open") {
+        if (existing != sessions.end()) {
+            send("", "error session " + id + " already exists");
+            return;
+        }
+        std::shared_ptr<Session> session = std::make_shared<Session>(id);
+        Runner &runner = session->runner;
+        runner.attach(data);
+        runner.getOutput().setBufferSize(sessionBufferSize);
+        runner.getOutput().setSink(std::unique_ptr<OutputSink>(new SessionSink(*this, id)));
+        if (!options.fusion) runner.disableFusion();
+        if (options.useJit) runner.enableJit(options.jitThreshold);
+        try {
+            runner.startMain();
+        } catch (RuntimeError &e) {
+            send(id, std::string("error ") + e.what());
+            return;
+        }
+        sessions.insert(std::make_pair(id, session));
+        schedule(session);
+    } else if (existing == sessions.end()) {
+        send("", "error no session " + id);
+    } else if (command == "input") {
+        std::shared_ptr<Session> session = existing->second;
+        std::string word;
+        while (fields >> word) {
+            session->words.push_back(word);
+        }
+        if (!session->scheduled && giveInput(*session)) schedule(session);
+    } else if (command == "undo") {
+        std::shared_ptr<Session> session = existing->second;
+        if (session->scheduled) {
+            send(id, "refused the session is running");
+        } else if (session->runner.restoreCheckpoint()) {
+            settle(session);
+        } else {
+            send(id, "refused there is nothing to undo");
+        }
+    } else if (command == "close") {
+        Session &session = *existing->second;
+        session.closed = true;
+        if (!session.scheduled) finish(session, "closed");
+    } else {
+        send("", "error unknown command " + command);
+    }
+}
+
+// Saves a session to a file, or restores it from one. The session's state is
+// copied to or from memory with the mutex held, but the file is written or
+// read without it, so other sessions are not held up by the disk.
+void Server::transfer(bool save, const std::string &id, const std::string &filename) {
+    ByteStream saved;
+    bool haveFile = false;
+    if (!save && !filename.empty()) {
+        haveFile = Runner::readSaveFile(filename, saved);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto existing = sessions.find(id);
+        if (existing == sessions.end()) {
+            send("", "error no session " + id);
+            return;
+        }
+        std::shared_ptr<Session> session = existing->second;
+        if (session->scheduled) {
+            send(id, "refused the session is running");
+            return;
+        }
+        if (filename.empty()) {
+            send(id, "refused expected a filename");
+            return;
+        }
+        if (!save) {
+            if (haveFile && session->runner.readSave(saved.bytes(), saved.size(), filename)) {
+                session->words.clear();
+                settle(session);
+            } else {
+                send(id, "refused could not restore " + filename);
+            }
+            return;
+        }
+        session->runner.writeSave(saved);
+    }
+
+    send(id, Runner::writeSaveFile(saved, filename) ? "saved" : "refused could not save " + filename);
+}
+
+void Server::worker() {
+    while (1) {
+        std::shared_ptr<Session> session;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            workAvailable.wait(lock, [this]() {
+                return !pending.empty() || (inputEnded && sessions.empty());
+            });
+            if (pending.empty()) return;
+            session = pending.front();
+            pending.pop_front();
+            if (session->closed) {
+                finish(*session, "closed");
+                continue;
+            }
+        }
+
+        Runner &runner = session->runner;
+        std::string error;
+        try {
+            runner.resume(options.timeSlice);
+        } catch (RuntimeError &e) {
+            runner.getOutput().flush();
+            error = std::string("error ") + e.what();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        session->scheduled = false;
+        if (!error.empty()) {
+            finish(*session, error);
+        } else {
+            settle(session);
+        }
+    }
+}
+
+// decide what happens next to a session that is not scheduled, according to
+// where its game has got to
+void Server::settle(std::shared_ptr<Session> session) {
+    RunStatus status = session->runner.getStatus();
+    if (status == RunStatus::Finished) {
+        finish(*session, "end");
+    } else if (session->closed) {
+        finish(*session, "closed");
+    } else if (status != RunStatus::WaitingForKey || giveInput(*session)) {
+        schedule(session);
+    } else if (inputEnded) {
+        finish(*session, "closed");
+    } else {
+        send(session->id, "wait");
+    }
+}
+
+void Server::schedule(std::shared_ptr<Session> session) {
+    session->scheduled = true;
+    pending.push_back(session);
+    workAvailable.notify_one();
+}
+
+// give a session waiting for a key the next word it has been sent, returning
+// false if it has none; each word starts a turn that can be undone
+bool Server::giveInput(Session &session) {
+    if (session.words.empty() || session.runner.getStatus() != RunStatus::WaitingForKey) {
+        return false;
+    }
+    session.runner.checkpoint();
+    session.runner.giveKey(session.words.front());
+    session.words.pop_front();
+    return true;
+}
+
+void Server::finish(Session &session, const std::string &message) {
+    send(session.id, message);
+    auto entry = sessions.find(session.id);
+    if (entry != sessions.end() && entry->second.get() == &session) {
+        sessions.erase(entry);
+    }
+    if (inputEnded && sessions.empty()) workAvailable.notify_all();
+}
+
+// no more commands are coming, so close the sessions that need some
+void Server::endInput() {
+    std::lock_guard<std::mutex> lock(mutex);
+    inputEnded = true;
+    std::vector<Session*> waiting;
+    for (auto &entry : sessions) {
+        if (!entry.second->scheduled) waiting.push_back(entry.second.get());
+    }
+    for (Session *session : waiting) {
+        finish(*session, "closed");
+    }
+    workAvailable.notify_all();
+}
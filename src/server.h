@@ -0,0 +1,92 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gamedata.h"
+#include "runner.h"
+
+struct ServerOptions {
+    unsigned threads = 0;           // 0 to use one per core
+    bool useJit = false;
+    unsigned jitThreshold = 0;
+    bool fusion = true;
+    // calls and backward jumps a session makes before another gets a turn
+    int64_t timeSlice = 100000;
+};
+
+// Runs any number of games at once over one shared GameData, each in its own
+// session with its own Runner. A fixed pool of worker threads takes turns
+// running whichever sessions have work to do, a time slice at a time; a
+// session waiting for input holds no thread at all. Sessions are
+// driven by lines read from one stream and report through lines written to
+// another, each naming the session it concerns:
+//
+//   open ID            start a new session running the game
+//   input ID TEXT      give TEXT to the session as what the player typed
+//   undo ID            take back the last word of input the session used
+//   save ID FILE       save the state of a session waiting for input
+//   restore ID FILE    replace the state of a session waiting for input
+//                      with one saved from any session of the same game
+//   close ID           end the session
+//
+//   ID output TEXT     the game printed TEXT (with backslashes, carriage
+//                      returns and newlines written as \\, \r and \n)
+//   ID wait            the game is waiting for input
+//   ID end             the game's main function returned
+//   ID error MESSAGE   the game stopped with a runtime error
+//   ID closed          the session was closed before it finished
+//   ID saved           the session was saved
+//   ID refused MESSAGE the session could not do what was asked
+//   error MESSAGE      a line could not be understood
+//
+// Once the input stream ends, sessions are closed as soon as they wait for
+// input they have not been given, and the server returns when none are left.
+class Server {
+public:
+    Server(std::shared_ptr<const GameData> data, const ServerOptions &options,
+           std::istream &in, std::ostream &out);
+    ~Server();
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+
+    void run();
+
+    // write one line of the protocol; safe to call from any thread
+    void send(const std::string &sessionId, const std::string &message);
+private:
+    struct Session;
+    void handle(const std::string &line);
+    void transfer(bool save, const std::string &id, const std::string &filename);
+    void worker();
+    void endInput();
+    // called with mutex held
+    void settle(std::shared_ptr<Session> session);
+    void schedule(std::shared_ptr<Session> session);
+    bool giveInput(Session &session);
+    void finish(Session &session, const std::string &message);
+
+    std::shared_ptr<const GameData> data;
+    ServerOptions options;
+    std::istream &in;
+    std::ostream &out;
+    std::mutex outMutex;
+
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::map<std::string, std::shared_ptr<Session>> sessions;
+    std::deque<std::shared_ptr<Session>> pending;
+    bool inputEnded;
+    std::vector<std::thread> workers;
+};
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef SHAPE_H
+#define SHAPE_H
+
+#include <algorithm>
+#include <vector>
+
+// The layout shared by every object with the same set of properties. An
+// object stores its property values in a flat array of slots, with the value
+// of the property properties[i] in slot i.
+struct Shape {
+    static constexpr int noSlot = -1;
+
+    int slotOf(unsigned propId) const {
+        auto iter = std::lower_bound(properties.begin(), properties.end(), propId);
+        if (iter == properties.end() || *iter != propId) return noSlot;
+        return iter - properties.begin();
+    }
+
+    // property ids, in ascending order
+    std::vector<unsigned> properties;
+};
+
+#endif
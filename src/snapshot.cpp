@@ -0,0 +1,400 @@
+/* **************************************************************************
+ * Snapshots
+ *
+ * Checkpoints of a running game, kept in memory so it can go back to them,
+ * and the binary form its state is saved to disk in. A save file holds:
+ *
+ *   "GTSV", format version, bytecode size, hash of the bytecode
+ *   each list, map and object that differs from the gamefile
+ *   each slot for lists, maps and objects made while running, and what the
+ *   ones in use hold
+ *   run status, value returned by the last function run
+ *   the stack, then each frame's function, position and base
+ *
+ * with every number 32 bits and every value a type byte followed by 32 bits,
+ * as in gamefiles. Frames of verified functions are checked against what the
+ * verifier proved when a save is loaded, since they will run unchecked.
+ *
+ * Part of GTRPE by Gren Drake
+ * **************************************************************************/
+#include <algorithm>
+#include <climits>
+#include <fstream>
+#include <iostream>
+#include <map>
+
+#include "heap.h"
+#include "runner.h"
+#include "verifier.h"
+
+namespace {
+
+    const uint32_t SAVEFILE_ID = 0x56535447;
+    const uint32_t saveVersion = 1;
+
+    void writeValue(ByteStream &out, const Value &value) {
+        out.add_8(value.type);
+        out.add_32(value.value);
+    }
+
+    void writeContents(ByteStream &out, const ListDef &list) {
+        out.add_32(list.items.size());
+        for (const Value &item : list.items) {
+            writeValue(out, item);
+        }
+    }
+
+    void writeContents(ByteStream &out, const MapDef &map) {
+        out.add_32(map.rows.size());
+        for (const ValueMap::Slot &slot : map.rows.slotList()) {
+            if (!slot.used) continue;
+            writeValue(out, slot.key);
+            writeValue(out, slot.value);
+        }
+    }
+
+    void writeContents(ByteStream &out, const ObjectDef &object) {
+        out.add_32(object.slots.size());
+        for (unsigned i = 0; i < object.slots.size(); ++i) {
+            out.add_32(object.shape->properties[i]);
+            writeValue(out, object.slots[i]);
+        }
+    }
+
+    // FNV-1a over the bytecode, to tell whether a save is from this gamefile
+    uint32_t fingerprint(const ByteStream &code) {
+        uint32_t hash = 2166136261u;
+        const uint8_t *bytes = code.bytes();
+        for (unsigned i = 0; i < code.size(); ++i) {
+            hash = (hash ^ bytes[i]) * 16777619u;
+        }
+        return hash;
+    }
+
+    // whether the working stack of a frame stopped before the instruction at
+    // offset, with pending values still to be pushed onto it, is one that the
+    // verifier's proof covers
+    bool frameFits(const CodeMap &map, unsigned offset, const Value *stack,
+                   unsigned depth, unsigned pending) {
+        if (offset >= map.at.size() || map.at[offset] == CodeMap::NotInstruction) {
+            return false;
+        }
+        const std::vector<CodeMap::Slot> &slots = map.stacks[offset];
+        if (slots.size() != depth + pending) return false;
+        for (unsigned i = 0; i < depth; ++i) {
+            if (slots[i].type != CodeMap::UnknownType && slots[i].type != stack[i].type) {
+                return false;
+            }
+            if (slots[i].constant && slots[i].value != stack[i].value) return false;
+        }
+        return true;
+    }
+
+}
+
+void Heap::write(ByteStream &out) const {
+    out.add_32(lists.copies.size());
+    for (const ListDef &list : lists.copies) {
+        out.add_32(list.ident);
+        writeContents(out, list);
+    }
+    out.add_32(maps.copies.size());
+    for (const MapDef &map : maps.copies) {
+        out.add_32(map.ident);
+        writeContents(out, map);
+    }
+    out.add_32(objects.copies.size());
+    for (const ObjectDef &object : objects.copies) {
+        out.add_32(object.ident);
+        writeContents(out, object);
+    }
+
+    writeMade(out, lists);
+    writeMade(out, maps);
+    writeMade(out, objects);
+}
+
+template<class T>
+void Heap::writeMade(ByteStream &out, const Containers<T> &kind) const {
+    out.add_32(kind.made.size());
+    for (unsigned i = 0; i < kind.made.size(); ++i) {
+        out.add_8(kind.madeFlags[i] != 0);
+        if (kind.madeFlags[i]) writeContents(out, kind.made[i]);
+    }
+}
+
+bool Heap::readContents(ByteCursor &in, ListDef &list) {
+    unsigned itemCount = in.read_count(5);
+    for (unsigned j = 0; j < itemCount; ++j) {
+        list.items.push_back(in.read_value());
+    }
+    return in.ok();
+}
+
+bool Heap::readContents(ByteCursor &in, MapDef &map) {
+    unsigned rowCount = in.read_count(10);
+    for (unsigned j = 0; j < rowCount; ++j) {
+        Value key = in.read_value();
+        Value value = in.read_value();
+        map.rows.set(key, value);
+    }
+    return in.ok();
+}
+
+bool Heap::readContents(ByteCursor &in, ObjectDef &object) {
+    unsigned propertyCount = in.read_count(9);
+    std::vector<unsigned> properties;
+    for (unsigned j = 0; j < propertyCount; ++j) {
+        unsigned propId = in.read_32();
+        if (!properties.empty() && propId <= properties.back()) return false;
+        properties.push_back(propId);
+        object.slots.push_back(in.read_value());
+    }
+    object.shape = shapeFor(properties);
+    return in.ok();
+}
+
+template<class T>
+bool Heap::readMade(ByteCursor &in, Containers<T> &kind) {
+    unsigned count = in.read_count(1);
+    if (count > static_cast<unsigned>(INT_MAX - firstRuntimeIdent)) return false;
+    for (unsigned i = 0; i < count; ++i) {
+        T container = T();
+        container.ident = firstRuntimeIdent + i;
+        bool inUse = in.read_8() != 0;
+        if (inUse && !readContents(in, container)) return false;
+        kind.made.push_back(container);
+        kind.madeFlags.push_back(inUse ? InUse : 0);
+        kind.madeEpochs.push_back(0);
+    }
+    for (unsigned i = count; i-- > 0; ) {
+        if (!kind.madeFlags[i]) kind.freeSlots.push_back(i);
+    }
+    return in.ok();
+}
+
+bool Heap::read(ByteCursor &in, unsigned version) {
+    load(*data);
+
+    unsigned count = in.read_count(8);
+    for (unsigned i = 0; i < count; ++i) {
+        ListDef list;
+        list.ident = in.read_32();
+        if (!readContents(in, list) || !data->lists.find(list.ident)) return false;
+        if (!lists.copies.insert(list)) return false;
+        lists.copyEpochs.push_back(0);
+        lists.copyScans.push_back(0);
+    }
+
+    count = in.read_count(8);
+    for (unsigned i = 0; i < count; ++i) {
+        MapDef map;
+        map.ident = in.read_32();
+        if (!readContents(in, map) || !data->maps.find(map.ident)) return false;
+        if (!maps.copies.insert(map)) return false;
+        maps.copyEpochs.push_back(0);
+        maps.copyScans.push_back(0);
+    }
+
+    count = in.read_count(8);
+    for (unsigned i = 0; i < count; ++i) {
+        ObjectDef object;
+        object.ident = in.read_32();
+        if (!readContents(in, object) || !data->objects.find(object.ident)) return false;
+        if (!objects.copies.insert(object)) return false;
+        objects.copyEpochs.push_back(0);
+        objects.copyScans.push_back(0);
+    }
+
+    // saves from before lists, maps and objects could be made have none
+    if (version >= 1) {
+        if (!readMade(in, lists) || !readMade(in, maps) || !readMade(in, objects)) return false;
+    }
+    return in.ok();
+}
+
+void Runner::checkpoint() {
+    Checkpoint saved;
+    saved.stack.assign(stack.begin(), stack.begin() + stackTop);
+    saved.frames = frames;
+    saved.status = status;
+    saved.lastResult = lastResult;
+    checkpoints.push_back(std::move(saved));
+    heap.checkpoint();
+    if (checkpoints.size() > checkpointLimit) {
+        checkpoints.pop_front();
+        heap.dropOldestCheckpoint();
+    }
+}
+
+bool Runner::restoreCheckpoint() {
+    if (checkpoints.empty()) return false;
+    Checkpoint &saved = checkpoints.back();
+    reserveStack(saved.stack.size());
+    std::copy(saved.stack.begin(), saved.stack.end(), stack.begin());
+    stackTop = saved.stack.size();
+    frames.swap(saved.frames);
+    status = saved.status;
+    lastResult = saved.lastResult;
+    checkpoints.pop_back();
+    heap.restore();
+    return true;
+}
+
+void Runner::setCheckpointLimit(unsigned limit) {
+    checkpointLimit = limit;
+    while (checkpoints.size() > limit) {
+        checkpoints.pop_front();
+        heap.dropOldestCheckpoint();
+    }
+}
+
+bool Runner::saveState(const std::string &filename) const {
+    ByteStream out;
+    writeSave(out);
+    return writeSaveFile(out, filename);
+}
+
+void Runner::writeSave(ByteStream &out) const {
+    out.add_32(SAVEFILE_ID);
+    out.add_32(saveVersion);
+    out.add_32(data->bytecode.size());
+    out.add_32(fingerprint(data->bytecode));
+    writeState(out);
+}
+
+bool Runner::writeSaveFile(const ByteStream &out, const std::string &filename) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "Could not write to ~" << filename << "~.\n";
+        return false;
+    }
+    out.write(file);
+    return static_cast<bool>(file);
+}
+
+void Runner::writeState(ByteStream &out) const {
+    heap.write(out);
+    out.add_8(static_cast<uint8_t>(status));
+    writeValue(out, lastResult);
+    out.add_32(stackTop);
+    for (unsigned i = 0; i < stackTop; ++i) {
+        writeValue(out, stack[i]);
+    }
+    out.add_32(frames.size());
+    for (const Frame &frame : frames) {
+        out.add_32(frame.function->ident);
+        out.add_32(frame.ip - frame.function->position);
+        out.add_32(frame.base);
+    }
+}
+
+bool Runner::loadState(const std::string &filename) {
+    MappedFile file;
+    if (!file.open(filename)) {
+        std::cerr << "Could not open ~" << filename << "~.\n";
+        return false;
+    }
+    return readSave(file.data(), file.size(), filename);
+}
+
+bool Runner::readSaveFile(const std::string &filename, ByteStream &saved) {
+    MappedFile file;
+    if (!file.open(filename)) {
+        std::cerr << "Could not open ~" << filename << "~.\n";
+        return false;
+    }
+    saved.append(file.data(), file.size());
+    return true;
+}
+
+bool Runner::readSave(const uint8_t *bytes, size_t size, const std::string &filename) {
+    ByteCursor in(bytes, size);
+    uint32_t fileId = in.read_32();
+    uint32_t version = in.read_32();
+    if (fileId != SAVEFILE_ID || version > saveVersion) {
+        std::cerr << '~' << filename << "~ is not a saved game.\n";
+        return false;
+    }
+    if (in.read_32() != data->bytecode.size() || in.read_32() != fingerprint(data->bytecode)) {
+        std::cerr << '~' << filename << "~ was saved from a different gamefile.\n";
+        return false;
+    }
+
+    // read everything before changing anything, so a bad save leaves the
+    // game as it was
+    Heap loadedHeap;
+    loadedHeap.load(*data);
+    bool valid = loadedHeap.read(in, version);
+    unsigned loadedStatus = in.read_8();
+    Value loadedResult = in.read_value();
+    unsigned depth = in.read_count(5);
+    std::vector<Value> values;
+    for (unsigned i = 0; i < depth; ++i) {
+        values.push_back(in.read_value());
+    }
+    unsigned frameCount = in.read_count(12);
+    std::vector<Frame> loadedFrames;
+    for (unsigned i = 0; i < frameCount && valid; ++i) {
+        int ident = in.read_32();
+        unsigned offset = in.read_32();
+        unsigned base = in.read_32();
+        const FunctionDef *function = data->functions.find(ident);
+        if (!function) {
+            valid = false;
+            break;
+        }
+        unsigned stackBase = base + function->arg_count + function->local_count;
+        loadedFrames.push_back(Frame{function, function->position + offset, base, stackBase});
+    }
+    valid = valid && in.ok() && in.atEnd()
+         && loadedStatus <= static_cast<unsigned>(RunStatus::OutOfBudget)
+         && (loadedStatus == static_cast<unsigned>(RunStatus::Finished)) == loadedFrames.empty();
+
+    // each frame's working stack runs up to where the next frame's locals
+    // start, and is about to have the value it is returned pushed onto it
+    std::map<const FunctionDef*, CodeMap> codeMaps;
+    unsigned needed = depth + 1;
+    unsigned bottom = 0;
+    for (unsigned i = 0; i < loadedFrames.size() && valid; ++i) {
+        const Frame &frame = loadedFrames[i];
+        const FunctionDef &function = *frame.function;
+        bool last = i + 1 == loadedFrames.size();
+        unsigned top = last ? depth : loadedFrames[i + 1].base;
+        unsigned end = functionEnd(*data, function);
+        if (frame.base < bottom || frame.base > top || frame.stackBase > top
+                || frame.ip - function.position >= end - function.position) {
+            valid = false;
+            break;
+        }
+        if (function.verified) {
+            CodeMap &map = codeMaps[&function];
+            if (map.at.empty()) {
+                FunctionDef copy = function;
+                verifyFunction(data->bytecode, end, copy, &map);
+            }
+            unsigned pending = !last || loadedStatus == static_cast<unsigned>(RunStatus::WaitingForKey);
+            valid = frameFits(map, frame.ip - function.position, values.data() + frame.stackBase,
+                              top - frame.stackBase, pending);
+            needed = std::max(needed, frame.stackBase + function.maxStack + 1);
+        }
+        bottom = top;
+    }
+    if (!valid) {
+        std::cerr << '~' << filename << "~ is truncated or corrupt.\n";
+        return false;
+    }
+
+    heap = std::move(loadedHeap);
+    reserveStack(needed);
+    std::copy(values.begin(), values.end(), stack.begin());
+    stackTop = depth;
+    frames.swap(loadedFrames);
+    status = static_cast<RunStatus>(loadedStatus);
+    lastResult = loadedResult;
+    checkpoints.clear();
+    // the objects now have shapes of their own, which may be at addresses
+    // the cache remembers from the old ones
+    resetPropertyCache();
+    return true;
+}
@@ -0,0 +1,29 @@
+#include <iterator>
+
+#include "gamedata.h"
+#include "stringcache.h"
+
+std::string_view StringCache::get(const GameData &data, const StringDef &string) {
+    if (!data.packedStrings) return string.text;
+
+    const Key key{ string.text.data(), string.length };
+    auto found = index.find(key);
+    if (found != index.end()) {
+        entries.splice(entries.begin(), entries, found->second);
+        return entries.front().text;
+    }
+
+    if (entries.size() < capacity || entries.empty()) {
+        entries.push_front(Entry());
+    } else {
+        index.erase(entries.back().key);
+        entries.splice(entries.begin(), entries, std::prev(entries.end()));
+    }
+    // decode before indexing the entry, in case the string is corrupt
+    Entry &entry = entries.front();
+    entry.key = Key{ nullptr, 0 };
+    data.stringText(string, entry.text);
+    entry.key = key;
+    index[key] = entries.begin();
+    return entry.text;
+}
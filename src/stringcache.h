@@ -0,0 +1,57 @@
+#ifndef STRINGCACHE_H
+#define STRINGCACHE_H
+
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+struct GameData;
+struct StringDef;
+
+// Keeps the text of the packed strings a runner printed most recently, so
+// that those shown every turn are not decoded every turn. Strings sharing
+// their text in the gamefile share an entry. Text of strings that are not
+// packed is returned as it is.
+class StringCache {
+public:
+    static const unsigned defaultCapacity = 64;
+
+    explicit StringCache(unsigned capacity = defaultCapacity)
+    : capacity(capacity)
+    { }
+
+    // the text of a string, valid until the next call
+    std::string_view get(const GameData &data, const StringDef &string);
+    void clear() {
+        index.clear();
+        entries.clear();
+    }
+private:
+    // where a string's coded text starts and how long it is once decoded;
+    // strings of different lengths can start at the same place
+    struct Key {
+        const char *coded;
+        unsigned length;
+
+        bool operator==(const Key &other) const {
+            return coded == other.coded && length == other.length;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &key) const {
+            return std::hash<const char*>()(key.coded) ^ key.length;
+        }
+    };
+    struct Entry {
+        Key key;
+        std::string text;
+    };
+
+    // most recently used first
+    std::list<Entry> entries;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+    unsigned capacity;
+};
+
+#endif
@@ -6,8 +6,7 @@
  *
  * Part of GTRPE by Gren Drake
  * **************************************************************************/
-#include <fstream>
-#include <string>
+#include <ostream>
 
 #include "value.h"
 
@@ -54,9 +53,7 @@ std::ostream& operator<<(std::ostream &out, const Value::Type &type) {
 
 std::ostream& operator<<(std::ostream &out, const Value &value) {
     out << '<' << value.type;
-    if (value.type == Value::Symbol) {
-        out << " ~" << value.text << '~';
-    } else if (value.type == Value::None) {
+    if (value.type == Value::None) {
         // nothing
     } else {
         out << ' ' << value.value;
@@ -1,7 +1,8 @@
 #ifndef VALUE_H
 #define VALUE_H
 
-#include <string>
+#include <iosfwd>
+#include <type_traits>
 
 struct Value {
     enum Type {
@@ -19,10 +20,13 @@ struct Value {
     };
 
     Type type;
+    // for Symbol values, this is an index into GameData::symbols
     int value;
-    std::string text;
 };
 
+static_assert(sizeof(Value) <= 8, "Value must fit in eight bytes");
+static_assert(std::is_trivially_copyable<Value>::value, "Value must be trivially copyable");
+
 std::ostream& operator<<(std::ostream &out, const Value::Type &type);
 std::ostream& operator<<(std::ostream &out, const Value &value);
 
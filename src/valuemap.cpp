@@ -0,0 +1,45 @@
+#include "valuemap.h"
+
+const Value* ValueMap::find(const Value &key) const {
+    if (slots.empty()) return nullptr;
+    const Slot &slot = slots[findSlot(key)];
+    return slot.used ? &slot.value : nullptr;
+}
+
+void ValueMap::set(const Value &key, const Value &value) {
+    // keep the table no more than three-quarters full
+    if ((count + 1) * 4 > slots.size() * 3) grow();
+    Slot &slot = slots[findSlot(key)];
+    if (!slot.used) {
+        slot.used = true;
+        slot.key = key;
+        ++count;
+    }
+    slot.value = value;
+}
+
+uint32_t ValueMap::hash(const Value &key) {
+    uint32_t h = static_cast<uint32_t>(key.value) * 0x9E3779B1u;
+    h ^= static_cast<uint32_t>(key.type) * 0x85EBCA6Bu;
+    return h ^ (h >> 16);
+}
+
+// find the slot holding key, or the empty slot where it would be added
+unsigned ValueMap::findSlot(const Value &key) const {
+    unsigned mask = slots.size() - 1;
+    unsigned index = hash(key) & mask;
+    while (slots[index].used) {
+        const Value &other = slots[index].key;
+        if (other.type == key.type && other.value == key.value) break;
+        index = (index + 1) & mask;
+    }
+    return index;
+}
+
+void ValueMap::grow() {
+    std::vector<Slot> oldSlots(slots.empty() ? 8 : slots.size() * 2, Slot{false, Value{}, Value{}});
+    oldSlots.swap(slots);
+    for (const Slot &slot : oldSlots) {
+        if (slot.used) slots[findSlot(slot.key)] = slot;
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef VALUEMAP_H
+#define VALUEMAP_H
+
+#include <cstdint>
+#include <vector>
+
+#include "value.h"
+
+// A hash table keyed on typed values, using open addressing with linear
+// probing. Keys are equal only if both their type and value match.
+class ValueMap {
+public:
+    struct Slot {
+        bool used;
+        Value key;
+        Value value;
+    };
+
+    ValueMap() : count(0) { }
+
+    const Value* find(const Value &key) const;
+    void set(const Value &key, const Value &value);
+    unsigned size() const {
+        return count;
+    }
+    const std::vector<Slot>& slotList() const {
+        return slots;
+    }
+private:
+    static uint32_t hash(const Value &key);
+    unsigned findSlot(const Value &key) const;
+    void grow();
+
+    std::vector<Slot> slots;
+    unsigned count;
+};
+
+#endif
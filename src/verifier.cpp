@@ -0,0 +1,358 @@
+/* **************************************************************************
+ * Bytecode Verifier
+ *
+ * Walks every path through a function's bytecode, tracking what is known
+ * about each slot of the working stack, to prove that the function can be
+ * run without the interpreter's per-instruction safety checks. A function
+ * passes if every instruction lies within the function, the stack depth at
+ * each instruction is the same along every path and never underflows, every
+ * jump target is a constant JumpTarget that lands on the start of an
+ * instruction, every local stored to is a constant index in range, and every
+ * call has a constant argument count.
+ *
+ * Part of GTRPE by Gren Drake
+ * **************************************************************************/
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <vector>
+
+#include "fusion.h"
+#include "gamedata.h"
+#include "opcode.h"
+#include "parallel.h"
+#include "verifier.h"
+
+namespace {
+
+    const int unknownType = CodeMap::UnknownType;
+
+    typedef CodeMap::Slot AbstractValue;
+
+    AbstractValue knownValue(int type, int value) {
+        return AbstractValue{type, true, value};
+    }
+    AbstractValue ofType(int type) {
+        return AbstractValue{type, false, 0};
+    }
+    AbstractValue unknownValue() {
+        return AbstractValue{unknownType, false, 0};
+    }
+
+    bool merge(AbstractValue &into, const AbstractValue &other) {
+        if (into.type != other.type) {
+            if (into.type == unknownType) return false;
+            into = unknownValue();
+            return true;
+        }
+        if (into.constant && (!other.constant || into.value != other.value)) {
+            into = ofType(into.type);
+            return true;
+        }
+        return false;
+    }
+
+    typedef std::vector<AbstractValue> AbstractStack;
+
+    class FunctionVerifier {
+    public:
+        FunctionVerifier(const ByteStream &code, unsigned start, unsigned end, int localCount)
+        : code(code), start(start), length(end - start), localCount(localCount),
+          states(length), reached(length, false), byteKind(length, Unseen),
+          jumpTargets(length, CodeMap::NoTarget), maxStack(0)
+        { }
+
+        bool verify(unsigned &maxStackOut);
+        void describe(CodeMap &map) const;
+    private:
+        enum ByteKind { Unseen, InstructionStart, Operand };
+
+        bool step(unsigned offset);
+        bool flowTo(unsigned offset, const AbstractStack &stack);
+        bool pop(AbstractStack &stack, AbstractValue &value);
+        bool jumpTarget(const AbstractValue &target, unsigned &offset) const;
+
+        const ByteStream &code;
+        unsigned start, length;
+        int localCount;
+        std::vector<AbstractStack> states;
+        std::vector<bool> reached;
+        std::vector<ByteKind> byteKind;
+        std::vector<int> jumpTargets;
+        std::vector<unsigned> worklist;
+        unsigned maxStack;
+    };
+
+    bool FunctionVerifier::verify(unsigned &maxStackOut) {
+        if (length == 0 || !flowTo(0, AbstractStack())) return false;
+        while (!worklist.empty()) {
+            unsigned offset = worklist.back();
+            worklist.pop_back();
+            if (!step(offset)) return false;
+        }
+        maxStackOut = maxStack;
+        return true;
+    }
+
+    void FunctionVerifier::describe(CodeMap &map) const {
+        map.at.assign(length, CodeMap::NotInstruction);
+        map.stacks.assign(length, AbstractStack());
+        for (unsigned i = 0; i < length; ++i) {
+            if (byteKind[i] == InstructionStart) {
+                map.at[i] = jumpTargets[i];
+                map.stacks[i] = states[i];
+            }
+        }
+    }
+
+    bool FunctionVerifier::flowTo(unsigned offset, const AbstractStack &stack) {
+        if (offset >= length) return false;
+        if (!reached[offset]) {
+            reached[offset] = true;
+            states[offset] = stack;
+            worklist.push_back(offset);
+            return true;
+        }
+
+        AbstractStack &existing = states[offset];
+        if (existing.size() != stack.size()) return false;
+        bool changed = false;
+        for (unsigned i = 0; i < stack.size(); ++i) {
+            if (merge(existing[i], stack[i])) changed = true;
+        }
+        if (changed) worklist.push_back(offset);
+        return true;
+    }
+
+    bool FunctionVerifier::pop(AbstractStack &stack, AbstractValue &value) {
+        if (stack.empty()) return false;
+        value = stack.back();
+        stack.pop_back();
+        return true;
+    }
+
+    bool FunctionVerifier::jumpTarget(const AbstractValue &target, unsigned &offset) const {
+        if (target.type != Value::JumpTarget || !target.constant) return false;
+        if (target.value < 0 || static_cast<unsigned>(target.value) >= length) return false;
+        offset = target.value;
+        return true;
+    }
+
+    bool FunctionVerifier::step(unsigned offset) {
+        AbstractStack stack = states[offset];
+        AbstractValue v1, v2;
+        unsigned size = 1, target = 0;
+        bool fallsThrough = true, jumps = false;
+
+        int opcode = code.read_8(start + offset);
+        switch(opcode) {
+            case Opcode::Return:
+                fallsThrough = false;
+                break;
+
+            case Opcode::Push0:
+            case Opcode::Push1:
+            case Opcode::PushNeg1:
+            case Opcode::Push8:
+            case Opcode::Push16:
+            case Opcode::Push32: {
+                int value = 0;
+                switch(opcode) {
+                    case Opcode::Push0:     size = 2; value = 0;    break;
+                    case Opcode::Push1:     size = 2; value = 1;    break;
+                    case Opcode::PushNeg1:  size = 2; value = -1;   break;
+                    case Opcode::Push8:     size = 3;               break;
+                    case Opcode::Push16:    size = 4;               break;
+                    case Opcode::Push32:    size = 6;               break;
+                }
+                if (offset + size > length) return false;
+                // the operands are within the function, so needn't be checked
+                ByteCursor operands = code.cursor(start + offset + 1);
+                int type = operands.next_8();
+                if (opcode == Opcode::Push8) {
+                    value = static_cast<int8_t>(operands.next_8());
+                } else if (opcode == Opcode::Push16) {
+                    value = static_cast<int16_t>(operands.next_16());
+                } else if (opcode == Opcode::Push32) {
+                    value = operands.next_32();
+                }
+                stack.push_back(knownValue(type, value));
+                break;
+            }
+
+            case Opcode::Store:
+                if (!pop(stack, v1) || !pop(stack, v2)) return false;
+                if (v1.type != Value::LocalVar || !v1.constant) return false;
+                if (v1.value < 0 || v1.value >= localCount) return false;
+                break;
+
+            case Opcode::Say:
+            case Opcode::SayUnsigned:
+            case Opcode::StackPop:
+                if (!pop(stack, v1)) return false;
+                break;
+            case Opcode::StackDup:
+                if (stack.empty()) return false;
+                stack.push_back(stack.back());
+                break;
+            case Opcode::StackPeek:
+                if (!pop(stack, v1)) return false;
+                if (v1.type == Value::Integer && v1.constant
+                        && v1.value >= 0 && v1.value < static_cast<int>(stack.size())) {
+                    stack.push_back(stack[v1.value]);
+                } else {
+                    stack.push_back(unknownValue());
+                }
+                break;
+            case Opcode::StackSize:
+                stack.push_back(knownValue(Value::Integer, stack.size()));
+                break;
+
+            case Opcode::Call: {
+                if (!pop(stack, v1) || !pop(stack, v2)) return false;
+                if (v2.type != Value::Integer || !v2.constant) return false;
+                unsigned count = v2.value > 0 ? v2.value : 0;
+                if (count > stack.size()) return false;
+                stack.resize(stack.size() - count);
+                stack.push_back(unknownValue());
+                break;
+            }
+
+            case Opcode::GetProp:
+            case Opcode::GetItem:
+                if (!pop(stack, v1) || !pop(stack, v2)) return false;
+                stack.push_back(unknownValue());
+                break;
+            case Opcode::HasProp:
+            case Opcode::HasItem:
+                if (!pop(stack, v1) || !pop(stack, v2)) return false;
+                stack.push_back(ofType(Value::Integer));
+                break;
+            case Opcode::GetSize:
+                if (!pop(stack, v1)) return false;
+                stack.push_back(ofType(Value::Integer));
+                break;
+            case Opcode::SetProp:
+            case Opcode::SetItem:
+                if (!pop(stack, v1) || !pop(stack, v2) || !pop(stack, v1)) return false;
+                break;
+
+            case Opcode::CompareTypes:
+            case Opcode::Compare:
+            case Opcode::Add:
+            case Opcode::Sub:
+            case Opcode::Mult:
+            case Opcode::Div:
+                if (!pop(stack, v1) || !pop(stack, v2)) return false;
+                stack.push_back(ofType(Value::Integer));
+                break;
+
+            case Opcode::Jump:
+                if (!pop(stack, v1) || !jumpTarget(v1, target)) return false;
+                fallsThrough = false;
+                jumps = true;
+                break;
+            case Opcode::JumpZero:
+            case Opcode::JumpNotZero:
+            case Opcode::JumpLessThan:
+            case Opcode::JumpLessThanEqual:
+            case Opcode::JumpGreaterThan:
+            case Opcode::JumpGreaterThanEqual:
+                if (!pop(stack, v1) || !pop(stack, v2)) return false;
+                if (!jumpTarget(v1, target)) return false;
+                jumps = true;
+                break;
+
+            case Opcode::WaitKey:
+                stack.push_back(unknownValue());
+                break;
+
+            case Opcode::NewList:
+                stack.push_back(ofType(Value::List));
+                break;
+            case Opcode::NewMap:
+                stack.push_back(ofType(Value::Map));
+                break;
+            case Opcode::NewObject:
+                stack.push_back(ofType(Value::Object));
+                break;
+
+            default:
+                return false;
+        }
+
+        if (byteKind[offset] == Operand) return false;
+        byteKind[offset] = InstructionStart;
+        for (unsigned i = 1; i < size; ++i) {
+            if (byteKind[offset + i] == InstructionStart) return false;
+            byteKind[offset + i] = Operand;
+        }
+
+        maxStack = std::max<unsigned>(maxStack, stack.size());
+        if (jumps) jumpTargets[offset] = target;
+        if (jumps && !flowTo(target, stack)) return false;
+        if (fallsThrough && !flowTo(offset + size, stack)) return false;
+        return true;
+    }
+
+}
+
+bool verifyFunction(const ByteStream &code, unsigned end, FunctionDef &function,
+                    CodeMap *map) {
+    function.verified = false;
+    function.maxStack = 0;
+    if (function.position >= end || end > code.size()) return false;
+
+    FunctionVerifier verifier(code, function.position, end,
+                              function.arg_count + function.local_count);
+    unsigned maxStack = 0;
+    if (!verifier.verify(maxStack)) return false;
+    function.verified = true;
+    function.maxStack = maxStack;
+    if (map) verifier.describe(*map);
+    return true;
+}
+
+void verifyFunctions(GameData &data, unsigned threads) {
+    // a function's code runs until the start of the next function; functions
+    // that share code are done together, in order, so that each stretch of
+    // the fused code is only written by one thread
+    std::map<unsigned, std::vector<FunctionDef*>> byPosition;
+    for (FunctionDef &function : data.functions) {
+        byPosition[function.position].push_back(&function);
+    }
+    std::vector<std::pair<unsigned, const std::vector<FunctionDef*>*>> bodies;
+    for (auto iter = byPosition.begin(); iter != byPosition.end(); ++iter) {
+        auto next = std::next(iter);
+        unsigned end = next == byPosition.end() ? data.bytecode.size() : next->first;
+        bodies.push_back(std::make_pair(end, &iter->second));
+    }
+
+    // the code may be a view of the gamefile mapping, which the first write
+    // would copy; do that copy here, before the threads share the stream
+    data.fusedCode = ByteStream();
+    data.fusedCode.append(data.bytecode);
+    parallelFor(bodies.size(), threads, [&data, &bodies](unsigned i) {
+        CodeMap map;
+        int localCount = std::numeric_limits<int>::max();
+        for (const FunctionDef *function : *bodies[i].second) {
+            localCount = std::min(localCount, function->arg_count + function->local_count);
+        }
+        for (FunctionDef *function : *bodies[i].second) {
+            if (verifyFunction(data.bytecode, bodies[i].first, *function, &map)) {
+                fuseFunction(data, *function, map, localCount);
+            }
+        }
+    });
+}
+
+unsigned functionEnd(const GameData &data, const FunctionDef &function) {
+    unsigned end = data.bytecode.size();
+    for (const FunctionDef &other : data.functions) {
+        if (other.position > function.position && other.position < end) {
+            end = other.position;
+        }
+    }
+    return end;
+}
@@ -0,0 +1,36 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include <vector>
+
+class ByteStream;
+struct FunctionDef;
+struct GameData;
+
+// What the verifier learned about each byte of a function that passed:
+// whether an instruction that can be reached starts there and, for jumps,
+// the offset within the function that the jump goes to. For each instruction
+// it also gives what is known about every slot of the working stack before
+// the instruction runs: its type, unless that is UnknownType, and its value
+// if constant.
+struct CodeMap {
+    enum { NotInstruction = -2, NoTarget = -1, UnknownType = -1 };
+    struct Slot {
+        int type;
+        bool constant;
+        int value;
+    };
+    std::vector<int> at;
+    std::vector<std::vector<Slot>> stacks;
+};
+
+bool verifyFunction(const ByteStream &code, unsigned end, FunctionDef &function,
+                    CodeMap *map = nullptr);
+// verify every function, and fuse the code of those that pass into
+// GameData::fusedCode, on up to threads threads at once
+void verifyFunctions(GameData &data, unsigned threads = 1);
+// where the code of function ends: the start of the next function, or the
+// end of the bytecode
+unsigned functionEnd(const GameData &data, const FunctionDef &function);
+
+#endif